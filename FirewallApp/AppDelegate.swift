@@ -98,6 +98,8 @@ class AppDelegate: NSObject, NSApplicationDelegate {
       activate(extensionInfo: systemExtensionInfo,
                mode: mode ?? .unknownAllow,
                rules: self.savedRules ?? [],
+               configuration: self.savedConfiguration ?? FilterConfiguration(),
+               rulesSnapshot: self.rulesSnapshot,
                logger: logger,
                approval: approval)
         .map({ manager in
@@ -151,18 +153,42 @@ class AppDelegate: NSObject, NSApplicationDelegate {
   }
   
   func applicationShouldTerminate(_ sender: NSApplication) -> NSApplication.TerminateReply {
+    var finished = false
+    let finish = { (rulesSnapshot: UInt64?) in
+      guard !finished else { return }
+      finished = true
+      self.finishTermination(rulesSnapshot: rulesSnapshot)
+    }
+    
+    // While the extension still runs; the next launch starts it from this snapshot.
+    // A stuck extension mustn't hold up quitting, the next launch sends the saved rules then.
+    if let filterModel = mainState?.filterModel {
+      filterModel.saveRulesSnapshot { rulesSnapshot in
+        DispatchQueue.main.async { finish(rulesSnapshot) }
+      }
+      DispatchQueue.main.asyncAfter(deadline: .now() + AppDelegate.rulesSnapshotTimeout) { finish(nil) }
+    } else {
+      finish(nil)
+    }
+    
+    return .terminateLater
+  }
+  
+  private static let rulesSnapshotTimeout: TimeInterval = 2
+  
+  private func finishTermination(rulesSnapshot: UInt64?) {
     disableNetworkExtension(extensionIdentifier: systemExtensionInfo.identifier)
       .sinkNoCancel(receiveCompletion: { _ in
         self.mainState.map { mainState in
           self.lastFilterMode = mainState.filterModel.filterMode.filterResult
           self.savedRules = mainState.filterModel.appsInfo.map { $0.rule }
+          self.savedConfiguration = mainState.filterModel.configuration
+          self.rulesSnapshot = rulesSnapshot
           self.rulesOptions = mainState.filterModel.rulesOptions
           self.rulesSort = mainState.filterModel.rulesSort
         }
         NSApp.reply(toApplicationShouldTerminate: true)
       }, receiveValue: { })
-    
-    return .terminateLater
   }
   
   private struct MainState {
@@ -220,6 +246,12 @@ class AppDelegate: NSObject, NSApplicationDelegate {
   
   @Defaults(json: "Rules")
   private var savedRules: [Rule]?
+  
+  @Defaults(json: "FilterConfiguration")
+  private var savedConfiguration: FilterConfiguration?
+  
+  @Defaults("RulesSnapshot")
+  private var rulesSnapshot: UInt64?
 
   @Defaults(rawValue: "RulesOptions")
   var rulesOptions: RulesOptions?
@@ -208,7 +208,7 @@ extension Publisher where Failure : Error {
   }
 }
 
-func activate(extensionInfo: SystemExtensionInfo, mode: FilterResult, rules: [Rule], logger: @escaping (String) -> Void, approval: @escaping SystemExtensionRequestApproval) -> AnyPublisher<NetworkFilterManager, Error> {
+func activate(extensionInfo: SystemExtensionInfo, mode: FilterResult, rules: [Rule], configuration: FilterConfiguration, rulesSnapshot: UInt64?, logger: @escaping (String) -> Void, approval: @escaping SystemExtensionRequestApproval) -> AnyPublisher<NetworkFilterManager, Error> {
   func checkVersion() -> AnyPublisher<Void, Error> {
     checkServiceVersion(extensionInfo: extensionInfo)
       .handleEvents(receiveSubscription: { _ in
@@ -291,7 +291,7 @@ func activate(extensionInfo: SystemExtensionInfo, mode: FilterResult, rules: [Ru
         .handleNonFatalError(isPermissionDenied, { reloadAndCheckVersion })
         .flatMap(enableNetworkExtensionAndLog)
     })
-    .tryMap { try ParagonNetworkFilterManager(mode: mode, rules: rules, serviceName: extensionInfo.machServiceName) }
+    .tryMap { try ParagonNetworkFilterManager(mode: mode, rules: rules, configuration: configuration, rulesSnapshot: rulesSnapshot, serviceName: extensionInfo.machServiceName) }
     .eraseToAnyPublisher()
 }
 
@@ -156,6 +156,50 @@ class NetFilterModel: ObservableObject {
     filterMode = .running(mode)
   }
   
+  var configuration: FilterConfiguration {
+    networkFilterManager.configuration
+  }
+  
+  func setPromptPolicy(_ policy: PromptPolicy) {
+    if case .failure = Result(catching: { try networkFilterManager.setPromptPolicy(policy) }) {
+      os_log(.error, "NetworkFilterManager: cannot set prompt policy")
+    }
+  }
+  
+  func updateEndpointRule(_ rule: EndpointRule) {
+    if case .failure = Result(catching: { try networkFilterManager.updateEndpointRule(rule) }) {
+      os_log(.error, "NetworkFilterManager: cannot update endpoint rule")
+    }
+  }
+  
+  func removeEndpointRule(id: UInt64) {
+    try? networkFilterManager.removeEndpointRule(id: id)
+  }
+  
+  func updateDomainRule(_ rule: DomainRule) {
+    if case .failure = Result(catching: { try networkFilterManager.updateDomainRule(rule) }) {
+      os_log(.error, "NetworkFilterManager: cannot update domain rule")
+    }
+  }
+  
+  func removeDomainRule(id: UInt64) {
+    try? networkFilterManager.removeDomainRule(id: id)
+  }
+  
+  func setRuleSchedule(_ schedule: RuleSchedule) {
+    if case .failure = Result(catching: { try networkFilterManager.setRuleSchedule(schedule) }) {
+      os_log(.error, "NetworkFilterManager: cannot set rule schedule")
+    }
+  }
+  
+  func removeRuleSchedule(ruleId: Rule.ID) {
+    try? networkFilterManager.removeRuleSchedule(ruleId: ruleId)
+  }
+  
+  func saveRulesSnapshot(completion: @escaping (UInt64?) -> Void) {
+    networkFilterManager.saveRulesSnapshot(completion: completion)
+  }
+  
   private let defaultsKeyPausedFilterMode = "PausedFilterMode"
   private let networkFilterManager: NetworkFilterManager
   private let askAccessCallback: AskAccessCallback
@@ -25,4 +25,11 @@
 #include <optional>
 #include <string>
 
+// Returns the path of the bundle containing the executable at the given path.
+// Results, including misses, are cached; cached bundles are revalidated
+// against the file system periodically.
 std::optional<std::string> ApplicationBundlePath(const std::string &path);
+
+// Drops cached results for executables and bundles under the given directory;
+// the prefix is matched by whole path components.
+void InvalidateApplicationBundlePath(const std::string &prefix);
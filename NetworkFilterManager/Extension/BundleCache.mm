@@ -22,36 +22,101 @@
 
 #import "BundleCache.hpp"
 
+#import <chrono>
+#import <list>
+#import <string_view>
 #import <unordered_map>
 
+#import <sys/stat.h>
+
 #import <Foundation/Foundation.h>
 
+#import <mcom/bundle_path.hpp>
+#import <mcom/file_path.hpp>
 #import <mcom/sync.hpp>
 
 namespace {
 
+// Bounded LRU of executable path -> bundle path. Executables outside of any
+// bundle are cached as negative entries which expire after a short while, so
+// that freshly installed applications are picked up. Positive entries remember
+// the identity of the bundle directory and are re-checked with stat(2) once
+// they get old, which catches applications that were moved, replaced or
+// deleted.
 class BundleCache {
  public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t kCapacity = 1024;
+  static constexpr Clock::duration kNegativeTtl = std::chrono::seconds{30};
+  static constexpr Clock::duration kRevalidateInterval =
+      std::chrono::seconds{10};
+
   std::optional<std::string> ApplicationBundlePath(const std::string &path) {
-    if (auto bundle = GetBundle(path)) {
-      return bundle.bundlePath.UTF8String;
-    } else {
-      return std::nullopt;
+    const auto now = Clock::now();
+
+    auto cached = Lookup(path);
+    if (cached) {
+      if (!cached->bundle_path) {
+        if (now - cached->checked < kNegativeTtl) {
+          return std::nullopt;
+        }
+      } else if (now - cached->checked < kRevalidateInterval) {
+        return cached->bundle_path;
+      } else if (StillValid(*cached)) {
+        MarkChecked(path, now);
+        return cached->bundle_path;
+      }
     }
+
+    // Resolve without holding the lock, it may hit the disk.
+    Entry entry{path, ResolveBundlePath(path), now, 0, 0};
+    if (entry.bundle_path) {
+      Identify(*entry.bundle_path, entry);
+    }
+
+    auto result = entry.bundle_path;
+    Insert(std::move(entry));
+    return result;
   }
 
-  NSBundle *GetBundle(const std::string &path) {
-    return cache_.Use([&](auto &cache) {
-      auto it = cache.find(path);
-      if (it != cache.end()) {
-        return it->second;
+  void Invalidate(const std::string &prefix) {
+    // Whole components only: "/Applications/Foo.app" must not match
+    // "/Applications/Foo.app2"
+    const auto has_prefix = [&](const std::string &str) {
+      return mcom::FilePathView{str}.HasPrefix(prefix);
+    };
+
+    cache_.Use([&](auto &cache) {
+      for (auto it = cache.lru.begin(); it != cache.lru.end();) {
+        if (has_prefix(it->path) ||
+            (it->bundle_path && has_prefix(*it->bundle_path))) {
+          cache.index.erase(it->path);
+          it = cache.lru.erase(it);
+        } else {
+          ++it;
+        }
       }
-      auto bundle = GetBundleDirect(path);
-      cache[path] = bundle;
-      return bundle;
     });
   }
 
+  static std::optional<std::string> ResolveBundlePath(const std::string &path) {
+    const auto lexical = mcom::ResolveBundlePathLexically(path);
+    switch (lexical.kind) {
+      case mcom::LexicalBundlePath::Kind::Bundle:
+        return std::string{lexical.path};
+      case mcom::LexicalBundlePath::Kind::NotBundle:
+        return std::nullopt;
+      case mcom::LexicalBundlePath::Kind::Unknown:
+        break;
+    }
+
+    if (auto bundle = GetBundleDirect(path)) {
+      return bundle.bundlePath.UTF8String;
+    }
+    return std::nullopt;
+  }
+
   static NSBundle *GetBundleDirect(const std::string &path) {
     NSURL *url = [NSURL fileURLWithFileSystemRepresentation:path.c_str()
                                                 isDirectory:NO
@@ -85,13 +150,97 @@ class BundleCache {
   }
 
  private:
-  using Cache = std::unordered_map<std::string, NSBundle *>;
+  struct Entry {
+    std::string path;
+    std::optional<std::string> bundle_path;
+    Clock::time_point checked;
+    dev_t device;
+    ino_t inode;
+  };
+
+  using List = std::list<Entry>;
+
+  struct Cache {
+    // Most recently used first. The index keys point into the list nodes.
+    List lru;
+    std::unordered_map<std::string_view, List::iterator> index;
+  };
+
+  static bool Identify(const std::string &bundle_path, Entry &entry) {
+    struct stat st;
+    if (0 != ::stat(bundle_path.c_str(), &st)) {
+      return false;
+    }
+    entry.device = st.st_dev;
+    entry.inode = st.st_ino;
+    return true;
+  }
+
+  static bool StillValid(const Entry &entry) {
+    Entry current = entry;
+    return Identify(*entry.bundle_path, current) &&
+           current.device == entry.device && current.inode == entry.inode;
+  }
+
+  // Returns a copy of the cached entry and marks it as most recently used.
+  std::optional<Entry> Lookup(const std::string &path) {
+    return cache_.Use([&](auto &cache) -> std::optional<Entry> {
+      auto it = cache.index.find(path);
+      if (it == cache.index.end()) {
+        return std::nullopt;
+      }
+      cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+      return *it->second;
+    });
+  }
+
+  void MarkChecked(const std::string &path, Clock::time_point now) {
+    cache_.Use([&](auto &cache) {
+      auto it = cache.index.find(path);
+      if (it != cache.index.end()) {
+        it->second->checked = now;
+      }
+    });
+  }
+
+  void Insert(Entry entry) {
+    cache_.Use([&](auto &cache) {
+      auto it = cache.index.find(entry.path);
+      if (it != cache.index.end()) {
+        // Keep the stored path, the index key refers to it.
+        auto &existing = *it->second;
+        existing.bundle_path = std::move(entry.bundle_path);
+        existing.checked = entry.checked;
+        existing.device = entry.device;
+        existing.inode = entry.inode;
+        cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+        return;
+      }
+
+      cache.lru.push_front(std::move(entry));
+      cache.index.emplace(cache.lru.front().path, cache.lru.begin());
+
+      while (cache.lru.size() > kCapacity) {
+        cache.index.erase(cache.lru.back().path);
+        cache.lru.pop_back();
+      }
+    });
+  }
+
   mcom::Sync<Cache> cache_;
 };
 
+BundleCache &GetBundleCache() {
+  static BundleCache bundle_cache;
+  return bundle_cache;
+}
+
 }  // namespace
 
 std::optional<std::string> ApplicationBundlePath(const std::string &path) {
-  static BundleCache bundle_cache_;
-  return bundle_cache_.ApplicationBundlePath(path);
+  return GetBundleCache().ApplicationBundlePath(path);
+}
+
+void InvalidateApplicationBundlePath(const std::string &prefix) {
+  GetBundleCache().Invalidate(prefix);
 }
@@ -31,7 +31,7 @@
 
 #include <bsm/libbsm.h>
 
-#import <mcom/process.hpp>
+#import <mcom/process_path_cache.hpp>
 
 namespace {
 
@@ -39,18 +39,68 @@ pid_t PidFromTokenData(NSData *data) {
   return audit_token_to_pid(*static_cast<const audit_token_t *>(data.bytes));
 }
 
+uint64_t PidVersionFromTokenData(NSData *data) {
+  return static_cast<uint64_t>(
+      audit_token_to_pidversion(*static_cast<const audit_token_t *>(data.bytes)));
+}
+
+// Shared by all flows; a process opening many connections resolves its path once.
+mcom::ProcessPathCache process_paths_;
+
 static nf::AccessCheckHandler global_handler_;
 
 template <class Completion>
-nf::AccessStatus HandlePacket(const nf::Application &application, Completion &&completion) {
+nf::AccessStatus HandlePacket(const nf::Application &application,
+                              const std::optional<nf::Endpoint> &remote, Completion &&completion) {
   if (!global_handler_) {
     return nf::AccessStatus::Allow;
   }
 
-  return global_handler_(application, std::forward<Completion>(completion));
+  return global_handler_(application, remote, std::forward<Completion>(completion));
+}
+
+std::optional<nf::Endpoint> RemoteEndpointOfFlow(NEFilterFlow *flow) {
+  nf::Endpoint remote;
+
+  if ([flow isKindOfClass:[NEFilterSocketFlow class]]) {
+    auto socket_flow = static_cast<NEFilterSocketFlow *>(flow);
+
+    std::string endpoint_hostname;
+    if ([socket_flow.remoteEndpoint isKindOfClass:[NWHostEndpoint class]]) {
+      auto host_endpoint = static_cast<NWHostEndpoint *>(socket_flow.remoteEndpoint);
+      if (host_endpoint.hostname) {
+        endpoint_hostname = host_endpoint.hostname.UTF8String;
+      }
+      remote.address = nf::IpAddress::Parse(endpoint_hostname.c_str());
+      remote.port = static_cast<uint16_t>(host_endpoint.port.intValue);
+    }
+
+    if (@available(macOS 11.0, *)) {
+      if (socket_flow.remoteHostname) {
+        remote.hostname = socket_flow.remoteHostname.UTF8String;
+      }
+    }
+
+    // Before macOS 11 there is no remoteHostname and socket flows have no
+    // URL, but flows connecting by name carry the name in the endpoint
+    if (remote.hostname.empty() && !remote.address) {
+      remote.hostname = std::move(endpoint_hostname);
+    }
+  }
+
+  if (remote.hostname.empty() && flow.URL.host) {
+    remote.hostname = flow.URL.host.UTF8String;
+  }
+
+  if (!remote.address && remote.hostname.empty()) {
+    return std::nullopt;
+  }
+
+  return remote;
 }
 
-mcom::Sync<std::optional<PacketHandler>> packet_handler_;
+mcom::SharedSync<std::optional<PacketHandler>> packet_handler_{
+    mcom::LockName{"nf.packet_handler"}};
 
 }  // namespace
 
@@ -87,7 +137,8 @@ void ResetPacketHandler() {
     return nil;
   }
 
-  mcom::Result<mcom::FilePath> path = mcom::ProcessPath(PidFromTokenData(token_data));
+  mcom::Result<mcom::FilePath> path =
+      process_paths_.Path(PidFromTokenData(token_data), PidVersionFromTokenData(token_data));
   if (!path) {
     return nil;
   }
@@ -135,28 +186,9 @@ static int kAppAssociation = 0;
 
 @implementation FilterDataProvider
 - (void)startFilterWithCompletionHandler:(void (^)(NSError *_Nullable))completionHandler {
-  auto hosts = [[NSMutableArray alloc] initWithArray:@[
-    @"apps.mzstatic.com", @"bag.itunes.apple.com", @"buy.itunes.apple.com",
-    @"init.itunes.apple.com", @"osxapps.itunes.apple.com", @"pd.itunes.app",
-    @"play.itunes.apple.com", @"se-edge.itunes.apple.com", @"xp.apple.com"
-  ]];
-
-  for (unsigned i = 0; i < 100; ++i) {
-    [hosts addObject:[NSString stringWithFormat:@"p%u-buy.itunes.apple.com", i]];
-  }
-
-  auto rules = [NSMutableArray new];
-
-  for (NSString *host in hosts) {
-    auto endpoint = [NWHostEndpoint endpointWithHostname:host port:@"0"];
-    auto network_rule = [[NENetworkRule alloc] initWithDestinationHost:endpoint
-                                                              protocol:NENetworkRuleProtocolAny];
-    auto filter_rule = [[NEFilterRule alloc] initWithNetworkRule:network_rule
-                                                          action:NEFilterActionAllow];
-    [rules addObject:filter_rule];
-  }
-
-  auto settings = [[NEFilterSettings alloc] initWithRules:rules
+  // Every flow reaches the provider; hosts that must always be reachable
+  // are allowed by domain rules instead (see DefaultDomainRules)
+  auto settings = [[NEFilterSettings alloc] initWithRules:@[]
                                             defaultAction:NEFilterActionFilterData];
 
   [self applySettings:settings
@@ -178,7 +210,7 @@ static int kAppAssociation = 0;
 
   switch (*status) {
     case nf::AccessStatus::Allow:
-      return packet_handler_.Use([](auto handler) {
+      return packet_handler_.UseShared([](const auto &handler) {
         if (handler) {
           return
               [NEFilterNewFlowVerdict filterDataVerdictWithFilterInbound:YES
@@ -207,7 +239,7 @@ static int kAppAssociation = 0;
 
   switch (status) {
     case nf::AccessStatus::Allow:
-      return packet_handler_.Use([&](auto handler) {
+      return packet_handler_.UseShared([&](const auto &handler) {
         if (handler) {
           handler->handler({static_cast<uint32_t>(readBytes.length),
                             nf::Packet::Direction::Incoming, *application});
@@ -251,7 +283,7 @@ static int kAppAssociation = 0;
 
   switch (status) {
     case nf::AccessStatus::Allow:
-      return packet_handler_.Use([&](auto handler) {
+      return packet_handler_.UseShared([&](const auto &handler) {
         if (handler) {
           handler->handler({static_cast<uint32_t>(readBytes.length),
                             nf::Packet::Direction::Outgoing, *application});
@@ -314,7 +346,7 @@ static int kAppAssociation = 0;
 
 - (nf::AccessStatus)checkAccessForFlow:(NEFilterFlow *)flow
                            application:(const nf::Application &)application {
-  return HandlePacket(application, [self, flow](auto access_status) {
+  return HandlePacket(application, RemoteEndpointOfFlow(flow), [self, flow](auto access_status) {
     auto verdict = (access_status == nf::AccessStatus::Allow)
                        ? [NEFilterNewFlowVerdict allowVerdict]
                        : [NEFilterNewFlowVerdict dropVerdict];
@@ -0,0 +1,439 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "RulesSnapshot.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstring>
+
+#include <mcom/codable.hpp>
+#include <mcom/file.hpp>
+
+namespace {
+
+constexpr char kMagic[4] = {'N', 'F', 'R', 'S'};
+constexpr uint32_t kVersion = 2;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t generation;
+  uint64_t rule_count;
+  uint64_t strings_size;
+  uint64_t sections_size;
+};
+
+// Fixed size, so that records can be validated and decoded in place. Paths
+// are stored one after another following the records.
+struct Record {
+  uint64_t id;
+  int64_t last_access;
+  uint64_t access_count;
+  uint64_t path_offset;
+  uint32_t path_length;
+  uint8_t permission;
+  uint8_t has_last_access;
+  uint8_t reserved[2];
+};
+
+static_assert(sizeof(Record) == 40);
+
+// The filter's other tables follow the paths in sections of their own, each
+// encoded with mcom::Encoder. Sections with an unknown tag are skipped.
+enum class SectionTag : uint32_t {
+  PromptPolicy = 1,
+  EndpointRules = 2,
+  DomainRules = 3,
+  Schedules = 4,
+};
+
+struct SectionHeader {
+  SectionTag tag;
+  uint32_t reserved;
+  uint64_t size;
+};
+
+std::error_code FormatError() {
+  return std::make_error_code(std::errc::illegal_byte_sequence);
+}
+
+bool IsValidPermission(nf::RulePermission permission) {
+  return uint8_t(permission) <= uint8_t(nf::RulePermission::Deny);
+}
+
+bool IsValidEndpointRule(const nf::EndpointRule &rule) {
+  return uint8_t(rule.network.AddressFamily()) <=
+             uint8_t(nf::IpAddress::Family::V6) &&
+         IsValidPermission(rule.permission);
+}
+
+}  // namespace
+
+namespace mcom {
+
+template <>
+struct codable<nf::PromptPolicy> {
+  void encode(const nf::PromptPolicy &policy, Encoder &encoder) {
+    encoder.EncodePod<int64_t>(policy.timeout.count());
+    encoder.EncodePod<uint8_t>(uint8_t(policy.default_verdict));
+    encoder.EncodePod<uint64_t>(policy.max_parked_flows);
+  }
+
+  nf::PromptPolicy decode(Decoder &decoder) {
+    nf::PromptPolicy policy;
+    policy.timeout = std::chrono::seconds{decoder.DecodePod<int64_t>()};
+    policy.default_verdict = nf::RulePermission(decoder.DecodePod<uint8_t>());
+    policy.max_parked_flows = decoder.DecodePod<uint64_t>();
+    return policy;
+  }
+};
+
+template <>
+struct codable<nf::EndpointRule> {
+  void encode(const nf::EndpointRule &rule, Encoder &encoder) {
+    encoder.EncodePod(rule.id);
+    encoder.EncodeString(rule.application);
+    encoder.EncodePod(rule.network.AddressFamily());
+    encoder.EncodePod(rule.network.Bytes());
+    encoder.EncodePod(rule.prefix_length);
+    encoder.EncodePod(rule.ports.first);
+    encoder.EncodePod(rule.ports.last);
+    encoder.EncodePod<uint8_t>(uint8_t(rule.permission));
+  }
+
+  nf::EndpointRule decode(Decoder &decoder) {
+    nf::EndpointRule rule;
+    rule.id = decoder.DecodePod<uint64_t>();
+    rule.application = decoder.DecodeString();
+    const auto family = decoder.DecodePod<nf::IpAddress::Family>();
+    rule.network = {family, decoder.DecodePod<std::array<uint8_t, 16>>()};
+    rule.prefix_length = decoder.DecodePod<uint8_t>();
+    rule.ports.first = decoder.DecodePod<uint16_t>();
+    rule.ports.last = decoder.DecodePod<uint16_t>();
+    rule.permission = nf::RulePermission(decoder.DecodePod<uint8_t>());
+    return rule;
+  }
+};
+
+template <>
+struct codable<nf::DomainRule> {
+  void encode(const nf::DomainRule &rule, Encoder &encoder) {
+    encoder.EncodePod(rule.id);
+    encoder.EncodeString(rule.pattern);
+    encoder.EncodePod<uint8_t>(uint8_t(rule.permission));
+  }
+
+  nf::DomainRule decode(Decoder &decoder) {
+    nf::DomainRule rule;
+    rule.id = decoder.DecodePod<uint64_t>();
+    rule.pattern = decoder.DecodeString();
+    rule.permission = nf::RulePermission(decoder.DecodePod<uint8_t>());
+    return rule;
+  }
+};
+
+template <>
+struct codable<nf::TimeWindow> {
+  void encode(const nf::TimeWindow &window, Encoder &encoder) {
+    encoder.EncodePod(window.days);
+    encoder.EncodePod(window.begin_minute);
+    encoder.EncodePod(window.end_minute);
+  }
+
+  nf::TimeWindow decode(Decoder &decoder) {
+    nf::TimeWindow window;
+    window.days = decoder.DecodePod<uint8_t>();
+    window.begin_minute = decoder.DecodePod<uint16_t>();
+    window.end_minute = decoder.DecodePod<uint16_t>();
+    return window;
+  }
+};
+
+template <>
+struct codable<nf::RuleSchedule> {
+  void encode(const nf::RuleSchedule &schedule, Encoder &encoder) {
+    encoder.EncodePod(schedule.rule_id);
+    encoder.Encode(schedule.windows);
+    encoder.EncodePod<uint8_t>(uint8_t(schedule.outside_permission));
+  }
+
+  nf::RuleSchedule decode(Decoder &decoder) {
+    nf::RuleSchedule schedule;
+    schedule.rule_id = decoder.DecodePod<uint64_t>();
+    schedule.windows = decoder.Decode<std::vector<nf::TimeWindow>>();
+    schedule.outside_permission =
+        nf::RulePermission(decoder.DecodePod<uint8_t>());
+    return schedule;
+  }
+};
+
+}  // namespace mcom
+
+namespace {
+
+template <class Fn>
+void EncodeSection(mcom::Encoder &encoder, SectionTag tag, Fn &&fn) {
+  mcom::Encoder section;
+  fn(section);
+
+  const auto &bytes = section.Bytes();
+  encoder.EncodePod(SectionHeader{tag, 0, bytes.size()});
+  encoder.AddBytes(bytes.data(), bytes.size());
+}
+
+bool DecodeSection(RulesSnapshot &snapshot, SectionTag tag,
+                   mcom::Decoder &decoder) {
+  switch (tag) {
+    case SectionTag::PromptPolicy:
+      snapshot.prompt_policy = decoder.Decode<nf::PromptPolicy>();
+      return !decoder.Failed() &&
+             IsValidPermission(snapshot.prompt_policy.default_verdict);
+
+    case SectionTag::EndpointRules:
+      snapshot.endpoint_rules =
+          decoder.Decode<std::vector<nf::EndpointRule>>();
+      return !decoder.Failed() &&
+             std::all_of(snapshot.endpoint_rules.begin(),
+                         snapshot.endpoint_rules.end(), IsValidEndpointRule);
+
+    case SectionTag::DomainRules:
+      snapshot.domain_rules = decoder.Decode<std::vector<nf::DomainRule>>();
+      return !decoder.Failed() &&
+             std::all_of(snapshot.domain_rules.begin(),
+                         snapshot.domain_rules.end(), [](auto &rule) {
+                           return IsValidPermission(rule.permission);
+                         });
+
+    case SectionTag::Schedules:
+      snapshot.schedules = decoder.Decode<std::vector<nf::RuleSchedule>>();
+      return !decoder.Failed() &&
+             std::all_of(snapshot.schedules.begin(), snapshot.schedules.end(),
+                         [](auto &schedule) {
+                           return IsValidPermission(
+                               schedule.outside_permission);
+                         });
+  }
+  return true;
+}
+
+std::error_code DecodeSections(RulesSnapshot &snapshot, const uint8_t *data,
+                               size_t size) {
+  while (size != 0) {
+    SectionHeader header;
+    if (size < sizeof(header)) {
+      return FormatError();
+    }
+    std::memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    size -= sizeof(header);
+
+    if (header.size > size) {
+      return FormatError();
+    }
+
+    mcom::Decoder decoder{mcom::ByteSpan{data, size_t(header.size)}};
+    if (!DecodeSection(snapshot, header.tag, decoder)) {
+      return FormatError();
+    }
+    data += header.size;
+    size -= header.size;
+  }
+  return {};
+}
+
+}  // namespace
+
+std::optional<mcom::FilePath> RulesSnapshotPath() {
+  char cache_dir[PATH_MAX];
+  if (0 == ::confstr(_CS_DARWIN_USER_CACHE_DIR, cache_dir, sizeof(cache_dir))) {
+    return std::nullopt;
+  }
+
+  return mcom::FilePath{cache_dir} / "rules.snapshot";
+}
+
+mcom::Result<RulesSnapshot> ReadRulesSnapshot(const mcom::FilePath &path) {
+  auto file = mcom::File::Open(path, mcom::File::Flags{}.Read());
+  if (!file) {
+    return file.Code();
+  }
+
+  auto mapping = file->Map(mcom::File::Access::Sequential);
+  if (!mapping) {
+    return mapping.Code();
+  }
+
+  const size_t size = mapping->Size();
+  if (size < sizeof(Header)) {
+    return FormatError();
+  }
+
+  Header header;
+  std::memcpy(&header, mapping->Data(), sizeof(header));
+  if (0 != std::memcmp(header.magic, kMagic, sizeof(kMagic)) ||
+      header.version != kVersion) {
+    return FormatError();
+  }
+
+  const size_t max_rules = (size - sizeof(Header)) / sizeof(Record);
+  if (header.rule_count > max_rules) {
+    return FormatError();
+  }
+
+  // Paths and sections take the rest
+  const size_t tail_size =
+      size - sizeof(Header) - header.rule_count * sizeof(Record);
+  if (header.strings_size > tail_size ||
+      header.sections_size != tail_size - header.strings_size) {
+    return FormatError();
+  }
+
+  const auto records = mapping->Data() + sizeof(Header);
+  const auto strings = reinterpret_cast<const char *>(
+      records + header.rule_count * sizeof(Record));
+
+  RulesSnapshot snapshot{header.generation, {}, {}};
+  snapshot.rules.reserve(header.rule_count);
+
+  for (uint64_t index = 0; index < header.rule_count; ++index) {
+    Record record;
+    std::memcpy(&record, records + index * sizeof(Record), sizeof(record));
+
+    if (record.path_offset > header.strings_size ||
+        record.path_length > header.strings_size - record.path_offset ||
+        record.permission > uint8_t(nf::RulePermission::Deny)) {
+      return FormatError();
+    }
+
+    std::optional<nf::Time> last_access;
+    if (record.has_last_access) {
+      last_access = nf::Time::clock::from_time_t(record.last_access);
+    }
+
+    snapshot.rules.emplace_back(
+        record.id, nf::RulePermission(record.permission),
+        nf::Application{std::string_view{strings + record.path_offset,
+                                         record.path_length}},
+        last_access, record.access_count);
+  }
+
+  const auto sections =
+      reinterpret_cast<const uint8_t *>(strings + header.strings_size);
+  if (auto error = DecodeSections(snapshot, sections, header.sections_size)) {
+    return error;
+  }
+
+  return std::move(snapshot);
+}
+
+std::error_code WriteRulesSnapshot(const mcom::FilePath &path,
+                                   const RulesSnapshot &snapshot) {
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.generation = snapshot.generation;
+  header.rule_count = snapshot.rules.size();
+  header.strings_size = 0;
+  for (auto &rule : snapshot.rules) {
+    header.strings_size += rule.Application().Path().size();
+  }
+
+  // Small next to the rules, so they are encoded up front to know their size
+  mcom::Encoder sections;
+  EncodeSection(sections, SectionTag::PromptPolicy, [&](auto &encoder) {
+    encoder.Encode(snapshot.prompt_policy);
+  });
+  EncodeSection(sections, SectionTag::EndpointRules, [&](auto &encoder) {
+    encoder.Encode(snapshot.endpoint_rules);
+  });
+  EncodeSection(sections, SectionTag::DomainRules, [&](auto &encoder) {
+    encoder.Encode(snapshot.domain_rules);
+  });
+  EncodeSection(sections, SectionTag::Schedules, [&](auto &encoder) {
+    encoder.Encode(snapshot.schedules);
+  });
+  const auto &sections_bytes = sections.Bytes();
+  header.sections_size = sections_bytes.size();
+
+  const auto temporary_path = path + ".tmp";
+  auto file = mcom::File::Open(
+      temporary_path, mcom::File::Flags{}.Write().Create(0600));
+  if (!file) {
+    return file.Code();
+  }
+  ::ftruncate(file->Descriptor(), 0);
+
+  // Streamed in chunks, so memory use doesn't grow with the rule count
+  mcom::FileSink sink{*file};
+  std::error_code error;
+  {
+    mcom::Encoder encoder{sink};
+    encoder.EncodePod(header);
+
+    uint64_t path_offset = 0;
+    for (auto &rule : snapshot.rules) {
+      const auto last_access = rule.LastAccessTime();
+      const auto &rule_path = rule.Application().Path();
+
+      Record record{};
+      record.id = rule.Id();
+      record.last_access =
+          last_access ? nf::Time::clock::to_time_t(*last_access) : 0;
+      record.access_count = rule.AccessCount();
+      record.path_offset = path_offset;
+      record.path_length = uint32_t(rule_path.size());
+      record.permission = uint8_t(rule.Permission());
+      record.has_last_access = last_access.has_value();
+      encoder.EncodePod(record);
+
+      path_offset += rule_path.size();
+    }
+
+    for (auto &rule : snapshot.rules) {
+      const auto &rule_path = rule.Application().Path();
+      encoder.AddBytes(reinterpret_cast<const uint8_t *>(rule_path.data()),
+                       rule_path.size());
+    }
+
+    encoder.AddBytes(sections_bytes.data(), sections_bytes.size());
+
+    error = encoder.Flush();
+  }
+
+  // Otherwise after a crash the rename may have reached the disk while the
+  // data hasn't, leaving a short or zero-filled snapshot
+  if (!error && 0 != ::fsync(file->Descriptor())) {
+    error = std::make_error_code(std::errc(errno));
+  }
+  if (!error) {
+    error = file->Close();
+  }
+  if (!error && 0 != ::rename(temporary_path.CString(), path.CString())) {
+    error = std::make_error_code(std::errc(errno));
+  }
+  if (error) {
+    mcom::File::Remove(temporary_path);
+  }
+
+  return error;
+}
@@ -0,0 +1,51 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <mcom/file_path.hpp>
+#include <mcom/result.hpp>
+
+#include <nf/nf.hpp>
+
+// The extension's rules as of some point, saved so that the next launch
+// doesn't need the client to send every rule again. The generation grows
+// with every snapshot written and is handed to the client, which names it
+// on the next launch.
+struct RulesSnapshot {
+  uint64_t generation;
+  // Application paths are already resolved to bundles
+  std::vector<nf::Rule> rules;
+  nf::PromptPolicy prompt_policy;
+  std::vector<nf::EndpointRule> endpoint_rules;
+  std::vector<nf::DomainRule> domain_rules;
+  std::vector<nf::RuleSchedule> schedules;
+};
+
+std::optional<mcom::FilePath> RulesSnapshotPath();
+
+// Decodes the rules directly from a read-only mapping of the file.
+mcom::Result<RulesSnapshot> ReadRulesSnapshot(const mcom::FilePath &path);
+
+// Replaces the file atomically; the data reaches the disk before the rename.
+std::error_code WriteRulesSnapshot(const mcom::FilePath &path,
+                                   const RulesSnapshot &snapshot);
@@ -22,12 +22,23 @@
 
 #include <os/log.h>
 
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <sstream>
+
 #include <mach/bootstrap.hpp>
 #include <mach/coding.hpp>
 #include <mach/message.hpp>
 #include <mach/server.hpp>
+#include <mcom/canonical_path_cache.hpp>
+#include <mcom/sync.hpp>
 
 #include "BundleCache.hpp"
+#include "RulesSnapshot.hpp"
 #include "extension.hpp"
 
 namespace mach {
@@ -71,6 +82,95 @@ struct Codable<nf::Rule> {
   }
 };
 
+template <>
+struct Codable<nf::IpAddress> {
+  void Encode(Encoder &encoder, const nf::IpAddress &address) {
+    encoder.EncodeTrivial(address.AddressFamily());
+    encoder.EncodeTrivial(address.Bytes());
+  }
+
+  nf::IpAddress Decode(Decoder &decoder) {
+    const auto family = decoder.DecodeTrivial<nf::IpAddress::Family>();
+    return {family, decoder.DecodeTrivial<std::array<uint8_t, 16>>()};
+  }
+};
+
+template <>
+struct Codable<nf::EndpointRule> {
+  void Encode(Encoder &encoder, const nf::EndpointRule &rule) {
+    encoder.EncodeTrivial(rule.id);
+    encoder.EncodeString(rule.application);
+    encoder.Encode(rule.network);
+    encoder.EncodeTrivial(rule.prefix_length);
+    encoder.EncodeTrivial(rule.ports.first);
+    encoder.EncodeTrivial(rule.ports.last);
+    encoder.EncodeTrivial(rule.permission);
+  }
+
+  nf::EndpointRule Decode(Decoder &decoder) {
+    nf::EndpointRule rule;
+    rule.id = decoder.DecodeTrivial<nf::RuleId>();
+    rule.application = decoder.DecodeString();
+    rule.network = Codable<nf::IpAddress>{}.Decode(decoder);
+    rule.prefix_length = decoder.DecodeTrivial<uint8_t>();
+    rule.ports.first = decoder.DecodeTrivial<uint16_t>();
+    rule.ports.last = decoder.DecodeTrivial<uint16_t>();
+    rule.permission = decoder.DecodeTrivial<nf::RulePermission>();
+    return rule;
+  }
+};
+
+template <>
+struct Codable<nf::DomainRule> {
+  void Encode(Encoder &encoder, const nf::DomainRule &rule) {
+    encoder.EncodeTrivial(rule.id);
+    encoder.EncodeString(rule.pattern);
+    encoder.EncodeTrivial(rule.permission);
+  }
+
+  nf::DomainRule Decode(Decoder &decoder) {
+    nf::DomainRule rule;
+    rule.id = decoder.DecodeTrivial<nf::RuleId>();
+    rule.pattern = decoder.DecodeString();
+    rule.permission = decoder.DecodeTrivial<nf::RulePermission>();
+    return rule;
+  }
+};
+
+template <>
+struct Codable<nf::TimeWindow> {
+  void Encode(Encoder &encoder, const nf::TimeWindow &window) {
+    encoder.EncodeTrivial(window.days);
+    encoder.EncodeTrivial(window.begin_minute);
+    encoder.EncodeTrivial(window.end_minute);
+  }
+
+  nf::TimeWindow Decode(Decoder &decoder) {
+    nf::TimeWindow window;
+    window.days = decoder.DecodeTrivial<uint8_t>();
+    window.begin_minute = decoder.DecodeTrivial<uint16_t>();
+    window.end_minute = decoder.DecodeTrivial<uint16_t>();
+    return window;
+  }
+};
+
+template <>
+struct Codable<nf::RuleSchedule> {
+  void Encode(Encoder &encoder, const nf::RuleSchedule &schedule) {
+    encoder.EncodeTrivial(schedule.rule_id);
+    encoder.Encode(schedule.windows);
+    encoder.EncodeTrivial(schedule.outside_permission);
+  }
+
+  nf::RuleSchedule Decode(Decoder &decoder) {
+    nf::RuleSchedule schedule;
+    schedule.rule_id = decoder.DecodeTrivial<nf::RuleId>();
+    schedule.windows = Codable<std::vector<nf::TimeWindow>>{}.Decode(decoder);
+    schedule.outside_permission = decoder.DecodeTrivial<nf::RulePermission>();
+    return schedule;
+  }
+};
+
 template <>
 struct Codable<nf::Packet> {
   void Encode(Encoder &encoder, const nf::Packet &packet) {
@@ -101,6 +201,32 @@ struct Codable<nf::PacketList> {
   }
 };
 
+template <>
+struct Codable<nf::PromptPolicy> {
+  void Encode(Encoder &encoder, const nf::PromptPolicy &policy) {
+    encoder.EncodeTrivial(int64_t(policy.timeout.count()));
+    encoder.EncodeTrivial(policy.default_verdict);
+    encoder.EncodeTrivial(uint32_t(policy.max_parked_flows));
+  }
+
+  nf::PromptPolicy Decode(Decoder &decoder) {
+    nf::PromptPolicy policy;
+    policy.timeout = std::chrono::seconds{decoder.DecodeTrivial<int64_t>()};
+    policy.default_verdict = decoder.DecodeTrivial<nf::RulePermission>();
+    policy.max_parked_flows = decoder.DecodeTrivial<uint32_t>();
+    return policy;
+  }
+};
+
+template <>
+struct Codable<nf::PendingPrompt> {
+  void Encode(Encoder &encoder, const nf::PendingPrompt &prompt) {
+    encoder.Encode(prompt.application);
+    encoder.EncodeTrivial(uint32_t(prompt.parked_flows));
+    encoder.Encode(prompt.asked_at);
+  }
+};
+
 template <>
 struct Codable<nf::RulesUpdate> {
   void Encode(Encoder &encoder, const nf::RulesUpdate &update) {
@@ -111,6 +237,17 @@ struct Codable<nf::RulesUpdate> {
       encoder.EncodeInt64(id);
     }
   }
+
+  nf::RulesUpdate Decode(Decoder &decoder) {
+    nf::RulesUpdate update;
+    update.is_full = decoder.DecodeInt32() != 0;
+    update.updated = Codable<std::vector<nf::Rule>>{}.Decode(decoder);
+    update.removed.resize(size_t(std::max(decoder.DecodeInt32(), 0)));
+    for (auto &id : update.removed) {
+      id = decoder.DecodeTrivial<nf::RuleId>();
+    }
+    return update;
+  }
 };
 
 }  // namespace mach
@@ -125,23 +262,87 @@ nf::Application ResolveApplicationPath(const nf::Application &application) {
   }
 }
 
-void FixRule(nf::Rule &rule) {
-  if (auto bundle_path = ApplicationBundlePath(rule.Application().Path())) {
-    rule = nf::Rule(rule.Id(), rule.Permission(), nf::Application{*bundle_path},
+mcom::CanonicalPathCache &CanonicalPaths() {
+  static mcom::CanonicalPathCache cache;
+  return cache;
+}
+
+void SetRulePath(nf::Rule &rule, const std::string &path) {
+  if (path != rule.Application().Path()) {
+    rule = nf::Rule(rule.Id(), rule.Permission(), nf::Application{path},
                     rule.LastAccessTime(), rule.AccessCount());
   }
 }
 
+// Processes are reported by their resolved paths and matched by their
+// bundles, so a rule naming a symbolic link or an executable inside a
+// bundle would never match
+std::string ResolveRulePath(const std::string &path) {
+  const auto canonical = CanonicalPaths().Canonical(path);
+  const auto bundle_path = ApplicationBundlePath(canonical.String());
+  return bundle_path ? *bundle_path : canonical.String();
+}
+
+void FixRule(nf::Rule &rule) {
+  const auto &path = rule.Application().Path();
+
+  // Prefix rules name a directory, not an executable
+  if (nf::IsPrefixRulePath(path)) {
+    const auto directory =
+        CanonicalPaths().Canonical(nf::PrefixRuleDirectory(path));
+    SetRulePath(rule, directory.String() + "/*");
+    return;
+  }
+
+  SetRulePath(rule, ResolveRulePath(path));
+}
+
+// Endpoint rules are looked up by the exact application, so prefix paths
+// can't be supported there
+bool FixEndpointRule(nf::EndpointRule &rule) {
+  if (nf::IsPrefixRulePath(rule.application)) {
+    return false;
+  }
+
+  rule.application = ResolveRulePath(rule.application);
+  return true;
+}
+
+// The client sends a rule when the user picked or changed its application,
+// so whatever we remember about the path may be out of date
+void InvalidateRulePath(const std::string &path) {
+  const std::string target{nf::IsPrefixRulePath(path)
+                               ? nf::PrefixRuleDirectory(path)
+                               : std::string_view{path}};
+  CanonicalPaths().Invalidate(target);
+  InvalidateApplicationBundlePath(target);
+}
+
 void FixRulesList(std::vector<nf::Rule> &rules) {
   for (auto &rule : rules) {
     FixRule(rule);
   }
 }
 
+// App Store hosts stay reachable whatever the user's rules are. The ids are
+// taken from the top of the range so they don't collide with client rules;
+// the client can still remove or override them.
+std::vector<nf::DomainRule> DefaultDomainRules() {
+  const char *patterns[] = {"*.itunes.apple.com", "apps.mzstatic.com",
+                            "pd.itunes.app", "xp.apple.com"};
+
+  std::vector<nf::DomainRule> rules;
+  auto id = std::numeric_limits<nf::RuleId>::max();
+  for (auto pattern : patterns) {
+    rules.push_back({id--, pattern, nf::RulePermission::Allow});
+  }
+  return rules;
+}
+
 class FilterDelegate {
  public:
   void RuleUpdated(const nf::Rule &rule) {
-    client_port_.Use([&](auto &port) {
+    client_port_.UseShared([&](const auto &port) {
       if (port) {
         mach::Send(201, *port, rule);
       }
@@ -150,7 +351,7 @@ class FilterDelegate {
 
   template <class Completion>
   void HandlePackets(const nf::PacketList &packets, Completion &&completion) {
-    client_port_.Use([&](auto &port) {
+    client_port_.UseShared([&](const auto &port) {
       if (!port) {
         return;
       }
@@ -166,7 +367,7 @@ class FilterDelegate {
   template <class Completion>
   void AskPermission(const nf::Application &application,
                      Completion &&completion) {
-    client_port_.Use([&](auto &port) {
+    client_port_.UseShared([&](const auto &port) {
       if (!port) {
         return;
       }
@@ -181,7 +382,7 @@ class FilterDelegate {
 
   template <class Completion>
   void SendRules(nf::RulesUpdate update, Completion &&completion) {
-    client_port_.Use([&](auto &port) {
+    client_port_.UseShared([&](const auto &port) {
       if (!port) {
         return;
       }
@@ -191,7 +392,7 @@ class FilterDelegate {
   }
 
  private:
-  mcom::Sync<std::optional<mach::SendRight>> client_port_;
+  mcom::SharedSync<std::optional<mach::SendRight>> client_port_;
 };
 
 template <class Server, class Filter>
@@ -206,6 +407,7 @@ void SetupFilter(Server &server, Filter &filter) {
 
   // update rule
   server.AddHandler(204, [&](nf::Rule rule) {
+    InvalidateRulePath(rule.Application().Path());
     FixRule(rule);
     filter.UpdateRule(std::move(rule));
   });
@@ -214,10 +416,135 @@ void SetupFilter(Server &server, Filter &filter) {
   server.AddHandler(205,
                     [&](nf::RuleId rule_id) { filter.RemoveRule(rule_id); });
 
-  SetAccessCheckHandler([&](auto &application, auto &&completion) {
-    return filter.CheckAccess(ResolveApplicationPath(application),
-                              std::move(completion));
+  // set prompt policy
+  server.AddHandler(
+      206, [&](nf::PromptPolicy policy) { filter.SetPromptPolicy(policy); });
+
+  // get pending prompts
+  server.AddHandler(
+      207, [&](mach::Promise<std::vector<nf::PendingPrompt>> result) {
+        result(filter.PendingPrompts());
+      });
+
+  // update endpoint rule
+  server.AddHandler(208, [&](nf::EndpointRule rule) {
+    InvalidateRulePath(rule.application);
+    if (!FixEndpointRule(rule)) {
+      os_log_error(OS_LOG_DEFAULT,
+                   "endpoint rule with prefix path: %{public}s",
+                   rule.application.c_str());
+      return;
+    }
+    filter.UpdateEndpointRule(rule);
+  });
+
+  // remove endpoint rule
+  server.AddHandler(
+      209, [&](nf::RuleId rule_id) { filter.RemoveEndpointRule(rule_id); });
+
+  // update domain rule
+  server.AddHandler(210, [&](nf::DomainRule rule) {
+    if (!filter.UpdateDomainRule(rule)) {
+      os_log_error(OS_LOG_DEFAULT, "invalid domain rule pattern: %{public}s",
+                   rule.pattern.c_str());
+    }
+  });
+
+  // remove domain rule
+  server.AddHandler(
+      211, [&](nf::RuleId rule_id) { filter.RemoveDomainRule(rule_id); });
+
+  // set rule schedule
+  server.AddHandler(212, [&](nf::RuleSchedule schedule) {
+    filter.SetRuleSchedule(schedule);
   });
+
+  // remove rule schedule
+  server.AddHandler(
+      213, [&](nf::RuleId rule_id) { filter.RemoveRuleSchedule(rule_id); });
+
+  for (auto &rule : DefaultDomainRules()) {
+    filter.UpdateDomainRule(rule);
+  }
+
+  SetAccessCheckHandler(
+      [&](auto &application, auto &remote, auto &&completion) {
+        return filter.CheckAccess(ResolveApplicationPath(application), remote,
+                                  std::move(completion));
+  });
+}
+
+// Saves the filter's rules when the client asks for it, so that the next
+// launch of the extension can start from them. The client keeps the
+// generation it was given along with its own copy of the rules.
+template <class Filter>
+class RulesSnapshotWriter {
+ public:
+  RulesSnapshotWriter(Filter &filter, mcom::FilePath path, uint64_t generation)
+      : filter_{filter}, path_{std::move(path)}, generation_{generation} {}
+
+  RulesSnapshotWriter &operator=(RulesSnapshotWriter &&) = delete;
+
+  // Replies with the generation of the new snapshot, or 0 if it couldn't be
+  // written.
+  void Write(mach::Promise<uint64_t> result) {
+    queue_.Async([this, result]() mutable {
+      const RulesSnapshot snapshot{generation_ + 1, filter_.Rules(),
+                                   filter_.GetPromptPolicy(),
+                                   filter_.EndpointRulesList(),
+                                   filter_.DomainRulesList(),
+                                   filter_.RuleSchedules()};
+      if (auto error = WriteRulesSnapshot(path_, snapshot)) {
+        os_log_error(OS_LOG_DEFAULT,
+                     "failed to write rules snapshot: %{public}s",
+                     error.message().c_str());
+        result(0);
+        return;
+      }
+
+      generation_ = snapshot.generation;
+      result(generation_);
+    });
+  }
+
+ private:
+  Filter &filter_;
+  const mcom::FilePath path_;
+  uint64_t generation_;
+  dispatch::Queue queue_{"com.paragon-software.FirewallApp.RulesSnapshot"};
+};
+
+// Puts back the tables a snapshot keeps besides the rules
+template <class Filter>
+void RestoreTables(Filter &filter, const RulesSnapshot &snapshot) {
+  filter.SetPromptPolicy(snapshot.prompt_policy);
+  for (auto &rule : snapshot.endpoint_rules) {
+    filter.UpdateEndpointRule(rule);
+  }
+  for (auto &rule : snapshot.domain_rules) {
+    filter.UpdateDomainRule(rule);
+  }
+  for (auto &schedule : snapshot.schedules) {
+    filter.SetRuleSchedule(schedule);
+  }
+}
+
+// One line per log message; os_log truncates long ones
+void LogServerStatistics(const mach::Server &server) {
+  char *text = nullptr;
+  size_t size = 0;
+  std::FILE *stream = ::open_memstream(&text, &size);
+  if (stream == nullptr) {
+    return;
+  }
+  server.Statistics().Dump(stream);
+  std::fclose(stream);
+
+  std::istringstream lines{std::string{text, size}};
+  std::free(text);
+  for (std::string line; std::getline(lines, line);) {
+    os_log(OS_LOG_DEFAULT, "%{public}s", line.c_str());
+  }
 }
 
 std::optional<std::string> MachServiceName() {
@@ -265,7 +592,79 @@ int main(int argc, const char *argv[]) {
     delegate.HandlePackets(packet_list, std::move(completion));
   }};
 
+  // Rules saved by the previous run, if they are usable. The first 254 that
+  // names their generation takes them; later ones only wait for the start.
+  struct SavedRules {
+    std::optional<RulesSnapshot> snapshot;
+    bool taken = false;
+  };
+  mcom::Sync<SavedRules> saved_rules;
+  const auto snapshot_path = RulesSnapshotPath();
+  uint64_t snapshot_generation = 0;
+  if (snapshot_path) {
+    if (auto result = ReadRulesSnapshot(*snapshot_path)) {
+      snapshot_generation = result->generation;
+      saved_rules.AccessUnsafely().snapshot = std::move(*result);
+    }
+  }
+  std::atomic<bool> filter_started{false};
+
   mach::Server server{*receive_right};
+  // Rule updates and the table messages after a start arrive in bursts;
+  // take what is queued in one wakeup. Handlers still run concurrently.
+  server.SetMaxBatchSize(16);
+
+  // The first SIGUSR1 starts collecting message statistics, each later one
+  // logs and resets them
+  std::signal(SIGUSR1, SIG_IGN);
+  dispatch::SignalSource statistics_signal{SIGUSR1};
+  bool collecting_statistics = false;
+  statistics_signal.SetEventHandler([&]() {
+    if (collecting_statistics) {
+      LogServerStatistics(server);
+      server.ResetStatistics();
+    } else {
+      server.EnableStatistics(true);
+      collecting_statistics = true;
+    }
+  });
+  statistics_signal.Resume();
+
+  // Creates the filter on the first call only
+  auto start_filter = [&](nf::FilterMode mode, RulesSnapshot contents,
+                          std::function<void()> completion) {
+    dispatch::Queue{}.Async([&, mode, contents = std::move(contents),
+                             completion]() mutable {
+      server.Suspend();
+
+      static dispatch_once_t once;
+      dispatch::Once(once, [&]() {
+        static nf::NetworkFilter filter{mode, std::move(contents.rules),
+                                        delegate, &rules};
+
+        SetupFilter(server, filter);
+        RestoreTables(filter, contents);
+
+        // save rules snapshot; replies with its generation, 0 on failure
+        if (snapshot_path) {
+          static RulesSnapshotWriter writer{filter, *snapshot_path,
+                                            snapshot_generation};
+          server.AddHandler(253, [](mach::Promise<uint64_t> result) {
+            writer.Write(std::move(result));
+          });
+        } else {
+          server.AddHandler(253,
+                            [](mach::Promise<uint64_t> result) { result(0); });
+        }
+
+        filter_started = true;
+      });
+
+      server.Resume();
+
+      completion();
+    });
+  };
 
   // version check
   server.AddHandler(250, [](mach::Promise<> promise) { promise(); });
@@ -274,25 +673,46 @@ int main(int argc, const char *argv[]) {
   server.AddHandler(
       251, [&](nf::FilterMode mode, std::vector<nf::Rule> rules_list,
                mach::Promise<> promise) {
+        // A full list comes with a new client; links may have changed since
+        // the paths were last resolved
+        CanonicalPaths().Clear();
         FixRulesList(rules_list);
 
-        dispatch::Queue{}.Async(
-            [&, mode, rules_list = std::move(rules_list), promise]() mutable {
-              server.Suspend();
+        // The other tables start out with their defaults; the client sends
+        // its own next
+        start_filter(mode, RulesSnapshot{0, std::move(rules_list), {}},
+                     [promise]() mutable { promise(); });
+      });
 
-              static dispatch_once_t once;
-              dispatch::Once(once, [&]() {
-                static nf::NetworkFilter filter{mode, std::move(rules_list),
-                                                delegate, &rules};
+  // initialize filter from the snapshot the client saved with 253, if the
+  // extension still has it. Replies 0 otherwise; the client should send all
+  // the rules with 251 then.
+  server.AddHandler(254, [&](nf::FilterMode mode, uint64_t generation,
+                             mach::Promise<uint32_t> result) {
+    RulesSnapshot contents{};
+    const bool accepted = saved_rules.Use([&](SavedRules &saved) {
+      if (filter_started || saved.taken) {
+        return true;
+      }
+      if (!saved.snapshot || saved.snapshot->generation != generation) {
+        return false;
+      }
 
-                SetupFilter(server, filter);
-              });
+      contents = std::move(*saved.snapshot);
+      saved.snapshot.reset();
+      saved.taken = true;
+      return true;
+    });
 
-              server.Resume();
+    if (!accepted) {
+      result(0);
+      return;
+    }
 
-              promise();
-            });
-      });
+    // Rules from a snapshot are already resolved
+    start_filter(mode, std::move(contents),
+                 [result]() mutable { result(1); });
+  });
 
   // set delegate
   server.AddHandler(200, [&](mach::SendRight port) {
@@ -75,6 +75,107 @@ public struct Statistic: Hashable {
   }
 }
 
+/// How the wait mode treats applications waiting for the user's answer.
+public struct PromptPolicy: Hashable, Codable {
+  /// Seconds until parked flows get the default verdict. No rule is created then.
+  public var timeout: Int64
+  public var defaultVerdict: RulePermission
+  /// Flows of an application beyond this many get the default verdict right away. With 0 the user isn't asked.
+  public var maxParkedFlows: UInt32
+
+  public init(timeout: Int64 = 60, defaultVerdict: RulePermission = .allow, maxParkedFlows: UInt32 = 256) {
+    self.timeout = timeout
+    self.defaultVerdict = defaultVerdict
+    self.maxParkedFlows = maxParkedFlows
+  }
+}
+
+/// Restricts what an application may do when talking to a remote network. Endpoint rules are consulted before
+/// the application's own rule, and the most specific one wins.
+public struct EndpointRule: Hashable, Identifiable, Codable {
+  /// Chosen by the client
+  public var id: UInt64
+  /// An application, not a directory prefix
+  public var application: Application
+  /// Textual IPv4 or IPv6 address
+  public var network: String
+  public var prefixLength: UInt8
+  public var ports: ClosedRange<UInt16>
+  public var permission: RulePermission
+
+  public init(id: UInt64, application: Application, network: String, prefixLength: UInt8, ports: ClosedRange<UInt16> = 0 ... .max, permission: RulePermission) {
+    self.id = id
+    self.application = application
+    self.network = network
+    self.prefixLength = prefixLength
+    self.ports = ports
+    self.permission = permission
+  }
+
+  /// The network as the extension takes it: the family, then 16 bytes in network order
+  var networkBytes: (family: UInt8, bytes: [UInt8])? {
+    var bytes = [UInt8](repeating: 0, count: 16)
+    if inet_pton(AF_INET, network, &bytes) == 1 { return (0, bytes) }
+    if inet_pton(AF_INET6, network, &bytes) == 1 { return (1, bytes) }
+    return nil
+  }
+
+  var isValid: Bool { networkBytes != nil && !application.path.hasSuffix("/*") }
+}
+
+/// Applies to flows of every application whose remote hostname matches the pattern: "apple.com" matches only that
+/// host, "*.apple.com" every host below it.
+public struct DomainRule: Hashable, Identifiable, Codable {
+  /// Chosen by the client
+  public var id: UInt64
+  public var pattern: String
+  public var permission: RulePermission
+
+  public init(id: UInt64, pattern: String, permission: RulePermission) {
+    self.id = id
+    self.pattern = pattern
+    self.permission = permission
+  }
+}
+
+/// Part of the week in local time: from beginMinute to endMinute past midnight on each of the days (bit 0 is
+/// Sunday). A window whose end is not after its begin runs over midnight into the next day.
+public struct TimeWindow: Hashable, Codable {
+  public var days: UInt8
+  public var beginMinute: UInt16
+  public var endMinute: UInt16
+
+  public init(days: UInt8, beginMinute: UInt16, endMinute: UInt16) {
+    self.days = days
+    self.beginMinute = beginMinute
+    self.endMinute = endMinute
+  }
+}
+
+/// Limits an application rule to the given windows; outside of them the application gets outsidePermission.
+public struct RuleSchedule: Hashable, Codable {
+  public var ruleId: Rule.ID
+  public var windows: [TimeWindow]
+  public var outsidePermission: RulePermission
+
+  public init(ruleId: Rule.ID, windows: [TimeWindow], outsidePermission: RulePermission) {
+    self.ruleId = ruleId
+    self.windows = windows
+    self.outsidePermission = outsidePermission
+  }
+}
+
+/// What the extension is told besides the application rules. It doesn't report these back, so the client keeps
+/// them and hands them to the next launch.
+public struct FilterConfiguration: Hashable, Codable {
+  public var promptPolicy = PromptPolicy()
+  public var endpointRules: [EndpointRule] = []
+  public var domainRules: [DomainRule] = []
+  public var schedules: [RuleSchedule] = []
+
+  public init() {}
+}
+
 public enum RulesUpdate {
   case full([Rule])
   case partial(updated: [Rule], removed: [Rule.ID])
@@ -151,6 +252,30 @@ public protocol NetworkFilterManager: AnyObject {
   func registerRulesUpdateCallback(_ callback: @escaping UpdateCallback)
 
   func registerStatisticUpdateCallback(_ callback: @escaping UpdateCallback)
+
+  /// As sent with the calls below, for the next launch.
+  var configuration: FilterConfiguration { get }
+
+  func setPromptPolicy(_ policy: PromptPolicy) throws
+
+  /// Adds the rule or replaces the one with its id.
+  func updateEndpointRule(_ rule: EndpointRule) throws
+
+  func removeEndpointRule(id: UInt64) throws
+
+  /// Adds the rule or replaces the one with its id.
+  func updateDomainRule(_ rule: DomainRule) throws
+
+  func removeDomainRule(id: UInt64) throws
+
+  /// Replaces the rule's schedule, if it has one.
+  func setRuleSchedule(_ schedule: RuleSchedule) throws
+
+  func removeRuleSchedule(ruleId: Rule.ID) throws
+
+  /// Makes the extension save its rules. Completes, on an arbitrary queue, with the snapshot's
+  /// generation, which starts the extension from the same rules next time without sending them all.
+  func saveRulesSnapshot(completion: @escaping (UInt64?) -> Void)
 }
 
 public extension NetworkFilterManager {
@@ -205,6 +330,56 @@ extension Rule: MachCodable {
   }
 }
 
+extension PromptPolicy: MachEncodable {
+  public func encode(with encoder: MachEncoder) {
+    encoder.encodeTrivial(timeout)
+    encoder.encodeTrivial(defaultVerdict)
+    encoder.encodeTrivial(maxParkedFlows)
+  }
+}
+
+extension EndpointRule: MachEncodable {
+  public func encode(with encoder: MachEncoder) {
+    let (family, bytes) = networkBytes ?? (family: 0, bytes: [UInt8](repeating: 0, count: 16))
+
+    encoder.encodeTrivial(id)
+    application.encode(with: encoder)
+    encoder.encodeTrivial(family)
+    bytes.withUnsafeBytes { bytes in
+      encoder.encodeTrivial(bytes.load(as: UInt64.self))
+      encoder.encodeTrivial(bytes.load(fromByteOffset: 8, as: UInt64.self))
+    }
+    encoder.encodeTrivial(prefixLength)
+    encoder.encodeTrivial(ports.lowerBound)
+    encoder.encodeTrivial(ports.upperBound)
+    encoder.encodeTrivial(permission)
+  }
+}
+
+extension DomainRule: MachEncodable {
+  public func encode(with encoder: MachEncoder) {
+    encoder.encodeTrivial(id)
+    encoder.encodeString(pattern)
+    encoder.encodeTrivial(permission)
+  }
+}
+
+extension TimeWindow: MachEncodable {
+  public func encode(with encoder: MachEncoder) {
+    encoder.encodeTrivial(days)
+    encoder.encodeTrivial(beginMinute)
+    encoder.encodeTrivial(endMinute)
+  }
+}
+
+extension RuleSchedule: MachEncodable {
+  public func encode(with encoder: MachEncoder) {
+    encoder.encodeTrivial(ruleId)
+    windows.encode(with: encoder)
+    encoder.encodeTrivial(outsidePermission)
+  }
+}
+
 extension Packet: MachDecodable {
   public init(from decoder: MachDecoder) throws {
     size = try decoder.decodeBasic()
@@ -290,27 +465,29 @@ public class ParagonNetworkFilterManager: NetworkFilterManager {
     }
   }
 
-  public init(mode: FilterResult, rules: [Rule], serviceName: String) throws {
-    port = try MachSendPort.lookup(name: serviceName)
+  public private(set) var configuration: FilterConfiguration
 
-    let rules = rules.map { rule -> Rule in
-      var rule = rule
-      rule.id = 0
-      return rule
+  public init(mode: FilterResult, rules: [Rule], configuration: FilterConfiguration, rulesSnapshot: UInt64?, serviceName: String) throws {
+    port = try MachSendPort.lookup(name: serviceName)
+    self.configuration = configuration
+
+    if try !ParagonNetworkFilterManager.startFromSnapshot(port: port, mode: mode, generation: rulesSnapshot) {
+      // The rules keep their ids, which schedules refer to
+      let encoder = MachEncoder()
+      rules.encode(with: encoder)
+      let rulesData = encoder.data
+
+      // initialize filter
+      try Message.sendWithReply(
+        remotePort: port,
+        messageId: 251,
+        items: [.outlineData(rulesData)],
+        plainData: .withUnsafeBytes(of: mode)
+      ).wait().get()
+
+      try ParagonNetworkFilterManager.send(configuration, to: port)
     }
 
-    let encoder = MachEncoder()
-    rules.encode(with: encoder)
-    let rulesData = encoder.data
-
-    // initialize filter
-    try Message.sendWithReply(
-      remotePort: port,
-      messageId: 251,
-      items: [.outlineData(rulesData)],
-      plainData: .withUnsafeBytes(of: mode)
-    ).wait().get()
-
     server = MachServer()
     manager = nf_manager_create()
     statistics_store = nf_statistics_store_create()
@@ -332,6 +509,40 @@ public class ParagonNetworkFilterManager: NetworkFilterManager {
     try Message.send(id: 200, remotePort: port, localPort: nil, items: [.port(.makeSend(server.port))], plainData: nil)
   }
 
+  /// The extension only has the snapshot it saved last, so any other generation is declined.
+  private static func startFromSnapshot(port: MachSendPort, mode: FilterResult, generation: UInt64?) throws -> Bool {
+    guard let generation = generation else { return false }
+
+    // Laid out like the extension's message: the generation is 8-byte aligned
+    struct Request {
+      var mode: FilterResult
+      var generation: UInt64
+    }
+
+    let reply = try Message.sendWithReplyRaw(
+      remotePort: port,
+      messageId: 254,
+      plainData: .withUnsafeBytes(of: Request(mode: mode, generation: generation)),
+      replyLayout: MessageLayout(plainDataSize: MemoryLayout<UInt32>.size)
+    ).wait().get()
+
+    return reply.plainData.load(as: UInt32.self) != 0
+  }
+
+  /// A snapshot has the configuration it was saved with, otherwise the extension starts with the defaults.
+  private static func send(_ configuration: FilterConfiguration, to port: MachSendPort) throws {
+    try Message.send(id: 206, remotePort: port, items: [.codable(configuration.promptPolicy)])
+    for rule in configuration.endpointRules {
+      try Message.send(id: 208, remotePort: port, items: [.codable(rule)])
+    }
+    for rule in configuration.domainRules {
+      try Message.send(id: 210, remotePort: port, items: [.codable(rule)])
+    }
+    for schedule in configuration.schedules {
+      try Message.send(id: 212, remotePort: port, items: [.codable(schedule)])
+    }
+  }
+
   private func handleRulesUpdate(_ update: RulesUpdate, completion: @escaping () -> Void) {
     let patch = nf_rules_update_create(update.isFull)
     defer { nf_rules_update_destroy(patch) }
@@ -415,6 +626,46 @@ public class ParagonNetworkFilterManager: NetworkFilterManager {
     try Message.send(id: 205, remotePort: port, plainData: Data.withUnsafeBytes(of: id))
   }
 
+  public func setPromptPolicy(_ policy: PromptPolicy) throws {
+    try Message.send(id: 206, remotePort: port, items: [.codable(policy)])
+    configuration.promptPolicy = policy
+  }
+
+  public func updateEndpointRule(_ rule: EndpointRule) throws {
+    guard rule.isValid else { throw NSError(domain: NSPOSIXErrorDomain, code: Int(EINVAL)) }
+
+    try Message.send(id: 208, remotePort: port, items: [.codable(rule)])
+    configuration.endpointRules.removeAll { $0.id == rule.id }
+    configuration.endpointRules.append(rule)
+  }
+
+  public func removeEndpointRule(id: UInt64) throws {
+    try Message.send(id: 209, remotePort: port, plainData: Data.withUnsafeBytes(of: id))
+    configuration.endpointRules.removeAll { $0.id == id }
+  }
+
+  public func updateDomainRule(_ rule: DomainRule) throws {
+    try Message.send(id: 210, remotePort: port, items: [.codable(rule)])
+    configuration.domainRules.removeAll { $0.id == rule.id }
+    configuration.domainRules.append(rule)
+  }
+
+  public func removeDomainRule(id: UInt64) throws {
+    try Message.send(id: 211, remotePort: port, plainData: Data.withUnsafeBytes(of: id))
+    configuration.domainRules.removeAll { $0.id == id }
+  }
+
+  public func setRuleSchedule(_ schedule: RuleSchedule) throws {
+    try Message.send(id: 212, remotePort: port, items: [.codable(schedule)])
+    configuration.schedules.removeAll { $0.ruleId == schedule.ruleId }
+    configuration.schedules.append(schedule)
+  }
+
+  public func removeRuleSchedule(ruleId: Rule.ID) throws {
+    try Message.send(id: 213, remotePort: port, plainData: Data.withUnsafeBytes(of: ruleId))
+    configuration.schedules.removeAll { $0.ruleId == ruleId }
+  }
+
   public func registerOnlineAccessChecker(_ callback: @escaping OnlineAccessCheckCallback) {
     permissionCallback = callback
   }
@@ -426,6 +677,13 @@ public class ParagonNetworkFilterManager: NetworkFilterManager {
   public func registerStatisticUpdateCallback(_ callback: @escaping UpdateCallback) {
     statCallback = callback
   }
+
+  public func saveRulesSnapshot(completion: @escaping (UInt64?) -> Void) {
+    Message.sendWithReplyRaw(remotePort: port, messageId: 253, replyLayout: MessageLayout(plainDataSize: MemoryLayout<UInt64>.size)).handle { result in
+      let generation = (try? result.get())?.plainData.load(as: UInt64.self) ?? 0
+      completion(generation != 0 ? generation : nil)
+    }
+  }
 }
 
 private class SafeCompletionWrapper {
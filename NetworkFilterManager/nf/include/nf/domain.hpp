@@ -0,0 +1,281 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mcom/string.hpp>
+
+namespace nf {
+
+enum class RulePermission;
+
+// A hostname pattern: "apple.com" matches only that host, "*.apple.com"
+// matches every host below apple.com but not apple.com itself. Names are
+// compared case-insensitively and a trailing dot is ignored.
+struct DomainPattern {
+  static std::optional<DomainPattern> Parse(std::string_view string) {
+    DomainPattern pattern;
+    pattern.subdomains = mcom::HasPrefix(string, "*.");
+    string = mcom::StripSuffix(mcom::StripPrefix(string, "*."), ".");
+    if (string.empty() ||
+        mcom::FindChar(string, '*') != std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    pattern.domain.assign(string);
+    std::transform(pattern.domain.begin(), pattern.domain.end(),
+                   pattern.domain.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return pattern;
+  }
+
+  std::string domain;
+  bool subdomains = false;
+};
+
+// Calls fn(label) for the labels of a hostname from the last to the first:
+// "www.apple.com" gives "com", "apple", "www".
+template <class Fn>
+void ForEachLabelReversed(std::string_view host, Fn &&fn) {
+  host = mcom::StripSuffix(host, ".");
+
+  while (!host.empty()) {
+    const auto dot = host.rfind('.');
+    if (dot == std::string_view::npos) {
+      fn(host);
+      return;
+    }
+    fn(host.substr(dot + 1));
+    host.remove_suffix(host.size() - dot);
+  }
+}
+
+// Maps domain patterns to values. Labels are stored from the top-level
+// domain down, so a lookup costs one map search per label of the host no
+// matter how many patterns there are.
+template <class Value>
+class DomainTrie {
+ public:
+  // Returns the value stored for the pattern, default constructing it first
+  // if needed.
+  Value &operator()(const DomainPattern &pattern) {
+    Node *node = &root_;
+    ForEachLabelReversed(pattern.domain, [&](std::string_view label) {
+      auto &child = node->children[std::string{label}];
+      if (!child) {
+        child = std::make_unique<Node>();
+      }
+      node = child.get();
+    });
+
+    auto &slot = pattern.subdomains ? node->subdomains : node->exact;
+    if (!slot) {
+      slot.emplace();
+    }
+    return *slot;
+  }
+
+  Value *Find(const DomainPattern &pattern) {
+    Node *node = &root_;
+    ForEachLabelReversed(pattern.domain, [&](std::string_view label) {
+      if (node) {
+        auto it = node->children.find(label);
+        node = it != node->children.end() ? it->second.get() : nullptr;
+      }
+    });
+    if (!node) {
+      return nullptr;
+    }
+
+    auto &slot = pattern.subdomains ? node->subdomains : node->exact;
+    return slot ? &*slot : nullptr;
+  }
+
+  bool Erase(const DomainPattern &pattern) {
+    std::vector<Node *> path{&root_};
+    ForEachLabelReversed(pattern.domain, [&](std::string_view label) {
+      if (auto node = path.back()) {
+        auto it = node->children.find(label);
+        path.push_back(it != node->children.end() ? it->second.get()
+                                                  : nullptr);
+      }
+    });
+    if (!path.back()) {
+      return false;
+    }
+
+    auto &slot = pattern.subdomains ? path.back()->subdomains
+                                    : path.back()->exact;
+    if (!slot) {
+      return false;
+    }
+    slot.reset();
+
+    // Drop the nodes that no longer lead to a value
+    std::vector<std::string_view> labels;
+    ForEachLabelReversed(pattern.domain, [&](std::string_view label) {
+      labels.push_back(label);
+    });
+    for (size_t index = labels.size(); index > 0; --index) {
+      auto node = path[index];
+      if (node->exact || node->subdomains || !node->children.empty()) {
+        break;
+      }
+      auto parent = path[index - 1];
+      parent->children.erase(parent->children.find(labels[index - 1]));
+    }
+
+    return true;
+  }
+
+  // The value of the most specific pattern matching the host, if any.
+  const Value *Match(std::string_view host) const {
+    const Node *node = &root_;
+    const Value *result = nullptr;
+    bool done = false;
+
+    ForEachLabelReversed(host, [&](std::string_view label) {
+      if (done) {
+        return;
+      }
+      // The labels left at this point make the host a subdomain of node
+      if (node->subdomains) {
+        result = &*node->subdomains;
+      }
+      auto it = node->children.find(label);
+      if (it == node->children.end()) {
+        done = true;
+        return;
+      }
+      node = it->second.get();
+    });
+
+    if (!done && node->exact) {
+      result = &*node->exact;
+    }
+    return result;
+  }
+
+  bool Empty() const { return root_.children.empty(); }
+
+ private:
+  struct CaseInsensitiveLess {
+    using is_transparent = void;
+
+    bool operator()(std::string_view lhs, std::string_view rhs) const {
+      return std::lexicographical_compare(
+          lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+          [](unsigned char a, unsigned char b) {
+            return std::tolower(a) < std::tolower(b);
+          });
+    }
+  };
+
+  struct Node {
+    std::optional<Value> exact;
+    std::optional<Value> subdomains;
+    std::map<std::string, std::unique_ptr<Node>, CaseInsensitiveLess>
+        children;
+  };
+
+  Node root_;
+};
+
+// Allows or denies connections to hosts regardless of the application.
+struct DomainRule {
+  uint64_t id;
+  std::string pattern;
+  RulePermission permission;
+};
+
+class DomainRules {
+ public:
+  bool Update(const DomainRule &rule) {
+    auto pattern = DomainPattern::Parse(rule.pattern);
+    if (!pattern) {
+      return false;
+    }
+
+    Remove(rule.id);
+    trie_(*pattern).push_back({rule.id, rule.permission});
+    rules_.emplace(rule.id, rule);
+    return true;
+  }
+
+  bool Remove(uint64_t rule_id) {
+    auto it = rules_.find(rule_id);
+    if (it == rules_.end()) {
+      return false;
+    }
+
+    const auto pattern = *DomainPattern::Parse(it->second.pattern);
+    if (auto entries = trie_.Find(pattern)) {
+      entries->erase(
+          std::remove_if(entries->begin(), entries->end(),
+                         [&](auto &entry) { return entry.id == rule_id; }),
+          entries->end());
+      if (entries->empty()) {
+        trie_.Erase(pattern);
+      }
+    }
+
+    rules_.erase(it);
+    return true;
+  }
+
+  // When several rules have the same pattern the latest one wins.
+  std::optional<RulePermission> Match(std::string_view host) const {
+    if (auto entries = trie_.Match(host)) {
+      return entries->back().permission;
+    }
+    return std::nullopt;
+  }
+
+  bool Empty() const { return rules_.empty(); }
+
+  std::vector<DomainRule> Rules() const {
+    std::vector<DomainRule> result;
+    result.reserve(rules_.size());
+    for (auto &kv : rules_) {
+      result.push_back(kv.second);
+    }
+    return result;
+  }
+
+ private:
+  struct Entry {
+    uint64_t id;
+    RulePermission permission;
+  };
+
+  std::unordered_map<uint64_t, DomainRule> rules_;
+  DomainTrie<std::vector<Entry>> trie_;
+};
+
+}  // namespace nf
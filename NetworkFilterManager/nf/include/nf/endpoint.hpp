@@ -0,0 +1,405 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nf {
+
+enum class RulePermission;
+
+class IpAddress {
+ public:
+  enum class Family : uint8_t { V4, V6 };
+
+  IpAddress() = default;
+
+  IpAddress(Family family, const std::array<uint8_t, 16> &bytes)
+      : family_{family}, bytes_{bytes} {}
+
+  // Accepts dotted IPv4 and textual IPv6 addresses. IPv4-mapped IPv6
+  // addresses are treated as IPv4.
+  static std::optional<IpAddress> Parse(const char *string) {
+    IpAddress address;
+    if (1 == ::inet_pton(AF_INET, string, address.bytes_.data())) {
+      address.family_ = Family::V4;
+      return address;
+    }
+
+    if (1 != ::inet_pton(AF_INET6, string, address.bytes_.data())) {
+      return std::nullopt;
+    }
+
+    static constexpr uint8_t kMappedPrefix[12] = {0, 0, 0, 0, 0,    0,
+                                                  0, 0, 0, 0, 0xff, 0xff};
+    if (0 == std::memcmp(address.bytes_.data(), kMappedPrefix,
+                         sizeof(kMappedPrefix))) {
+      std::memmove(address.bytes_.data(), address.bytes_.data() + 12, 4);
+      std::fill(address.bytes_.begin() + 4, address.bytes_.end(), 0);
+      address.family_ = Family::V4;
+      return address;
+    }
+
+    address.family_ = Family::V6;
+    return address;
+  }
+
+  Family AddressFamily() const { return family_; }
+
+  uint8_t BitLength() const { return family_ == Family::V4 ? 32 : 128; }
+
+  // Network order, only the first four bytes are used for IPv4.
+  const std::array<uint8_t, 16> &Bytes() const { return bytes_; }
+
+  std::string ToString() const {
+    char buffer[INET6_ADDRSTRLEN];
+    ::inet_ntop(family_ == Family::V4 ? AF_INET : AF_INET6, bytes_.data(),
+                buffer, sizeof(buffer));
+    return buffer;
+  }
+
+ private:
+  Family family_ = Family::V4;
+  std::array<uint8_t, 16> bytes_{};
+};
+
+// The remote side of a flow. The address is missing when the flow only
+// names a host, and the hostname is empty when it isn't known.
+struct Endpoint {
+  std::optional<IpAddress> address;
+  uint16_t port = 0;
+  std::string hostname;
+};
+
+struct PortRange {
+  uint16_t first = 0;
+  uint16_t last = 0xffff;
+
+  bool Contains(uint16_t port) const { return first <= port && port <= last; }
+
+  uint32_t Size() const { return uint32_t(last) - first + 1; }
+};
+
+// Restricts what an application may do when talking to a remote network.
+// Endpoint rules are consulted before the application's own rule.
+struct EndpointRule {
+  uint64_t id;
+  std::string application;
+  IpAddress network;
+  uint8_t prefix_length;
+  PortRange ports;
+  RulePermission permission;
+};
+
+// Path-compressed binary trie over address bits, mapping network prefixes
+// to values. Lookups visit at most one node per stored prefix length on the
+// way to the address.
+template <class Value>
+class CidrTree {
+ public:
+  using Bits = std::array<uint8_t, 16>;
+
+  // Returns the value stored for the prefix, default constructing it first
+  // if needed.
+  Value &operator()(const Bits &prefix, uint8_t length) {
+    const Bits key = Masked(prefix, length);
+    Node *node = &root_;
+
+    while (node->length != length) {
+      auto &slot = node->children[Bit(key, node->length)];
+      if (!slot) {
+        slot = std::make_unique<Node>(key, length);
+        return slot->value.emplace();
+      }
+
+      const uint8_t common = CommonLength(slot->prefix, key,
+                                          std::min(slot->length, length));
+      if (common < slot->length) {
+        auto middle = std::make_unique<Node>(Masked(key, common), common);
+        middle->children[Bit(slot->prefix, common)] = std::move(slot);
+        slot = std::move(middle);
+      }
+
+      node = slot.get();
+    }
+
+    if (!node->value) {
+      node->value.emplace();
+    }
+    return *node->value;
+  }
+
+  Value *Find(const Bits &prefix, uint8_t length) {
+    const Bits key = Masked(prefix, length);
+    Node *node = &root_;
+
+    while (node && node->length < length) {
+      auto &child = node->children[Bit(key, node->length)];
+      if (!child || child->length > length ||
+          CommonLength(child->prefix, key, child->length) < child->length) {
+        return nullptr;
+      }
+      node = child.get();
+    }
+
+    return node && node->length == length && node->value ? &*node->value
+                                                          : nullptr;
+  }
+
+  bool Erase(const Bits &prefix, uint8_t length) {
+    return Erase(root_, Masked(prefix, length), length);
+  }
+
+  // Calls fn(value) for every prefix containing the address, from the
+  // shortest to the longest.
+  template <class Fn>
+  void ForEachMatch(const Bits &address, uint8_t address_length,
+                    Fn &&fn) const {
+    const Node *node = &root_;
+    if (node->value) {
+      fn(*node->value);
+    }
+
+    while (node->length < address_length) {
+      const auto &child = node->children[Bit(address, node->length)];
+      if (!child || child->length > address_length ||
+          CommonLength(child->prefix, address, child->length) <
+              child->length) {
+        return;
+      }
+
+      node = child.get();
+      if (node->value) {
+        fn(*node->value);
+      }
+    }
+  }
+
+  bool Empty() const {
+    return !root_.value && !root_.children[0] && !root_.children[1];
+  }
+
+ private:
+  struct Node {
+    Node() = default;
+
+    Node(const Bits &prefix, uint8_t length) : prefix{prefix}, length{length} {}
+
+    Bits prefix{};
+    uint8_t length = 0;
+    std::optional<Value> value;
+    std::unique_ptr<Node> children[2];
+  };
+
+  static int Bit(const Bits &bits, uint8_t index) {
+    return (bits[index / 8] >> (7 - index % 8)) & 1;
+  }
+
+  static Bits Masked(const Bits &bits, uint8_t length) {
+    Bits result{};
+    const uint8_t full_bytes = length / 8;
+    std::copy(bits.begin(), bits.begin() + full_bytes, result.begin());
+    if (length % 8) {
+      result[full_bytes] = bits[full_bytes] & uint8_t(0xff << (8 - length % 8));
+    }
+    return result;
+  }
+
+  static uint8_t CommonLength(const Bits &lhs, const Bits &rhs,
+                              uint8_t max_length) {
+    uint8_t length = 0;
+    for (size_t index = 0; length < max_length; ++index) {
+      const uint8_t diff = lhs[index] ^ rhs[index];
+      if (diff == 0) {
+        length += 8;
+        continue;
+      }
+      int bit = 7;
+      while (!(diff & (1 << bit))) {
+        --bit;
+        ++length;
+      }
+      break;
+    }
+    return std::min(length, max_length);
+  }
+
+  static bool Erase(Node &node, const Bits &key, uint8_t length) {
+    if (node.length == length) {
+      if (!node.value) {
+        return false;
+      }
+      node.value.reset();
+      return true;
+    }
+
+    auto &child = node.children[Bit(key, node.length)];
+    if (!child || child->length > length ||
+        CommonLength(child->prefix, key, child->length) < child->length) {
+      return false;
+    }
+
+    if (!Erase(*child, key, length)) {
+      return false;
+    }
+
+    if (!child->value) {
+      if (!child->children[0] && !child->children[1]) {
+        child.reset();
+      } else if (!child->children[0] || !child->children[1]) {
+        // A value-less node with a single child only adds a hop
+        auto &grandchild =
+            child->children[0] ? child->children[0] : child->children[1];
+        child = std::move(grandchild);
+      }
+    }
+
+    return true;
+  }
+
+  Node root_;
+};
+
+// Endpoint rules of all applications, indexed for lookup by application path
+// and remote address.
+class EndpointRules {
+ public:
+  void Update(const EndpointRule &rule) {
+    Remove(rule.id);
+
+    rules_.emplace(rule.id, rule);
+    Tree(rule.application, rule.network.AddressFamily())(
+        rule.network.Bytes(), ClampedLength(rule))
+        .push_back({rule.id, rule.ports, rule.permission});
+  }
+
+  bool Remove(uint64_t rule_id) {
+    auto it = rules_.find(rule_id);
+    if (it == rules_.end()) {
+      return false;
+    }
+
+    const auto &rule = it->second;
+    auto &tree = Tree(rule.application, rule.network.AddressFamily());
+    const auto length = ClampedLength(rule);
+
+    if (auto entries = tree.Find(rule.network.Bytes(), length)) {
+      entries->erase(
+          std::remove_if(entries->begin(), entries->end(),
+                         [&](auto &entry) { return entry.id == rule_id; }),
+          entries->end());
+      if (entries->empty()) {
+        tree.Erase(rule.network.Bytes(), length);
+      }
+    }
+
+    auto tables = tables_.find(rule.application);
+    if (tables->second.v4.Empty() && tables->second.v6.Empty()) {
+      tables_.erase(tables);
+    }
+
+    rules_.erase(it);
+    return true;
+  }
+
+  // Verdict of the most specific rule covering the endpoint: the longest
+  // network prefix wins, and within one prefix the narrowest port range.
+  std::optional<RulePermission> Match(const std::string &application,
+                                      const Endpoint &endpoint) const {
+    if (!endpoint.address) {
+      return std::nullopt;
+    }
+
+    auto tables = tables_.find(application);
+    if (tables == tables_.end()) {
+      return std::nullopt;
+    }
+
+    const auto &address = *endpoint.address;
+    const auto &tree = address.AddressFamily() == IpAddress::Family::V4
+                           ? tables->second.v4
+                           : tables->second.v6;
+
+    std::optional<RulePermission> result;
+    tree.ForEachMatch(address.Bytes(), address.BitLength(), [&](auto &entries) {
+      const PortEntry *best = nullptr;
+      for (auto &entry : entries) {
+        if (entry.ports.Contains(endpoint.port) &&
+            (!best || entry.ports.Size() < best->ports.Size())) {
+          best = &entry;
+        }
+      }
+      if (best) {
+        result = best->permission;
+      }
+    });
+    return result;
+  }
+
+  bool Empty() const { return rules_.empty(); }
+
+  std::vector<EndpointRule> Rules() const {
+    std::vector<EndpointRule> result;
+    result.reserve(rules_.size());
+    for (auto &kv : rules_) {
+      result.push_back(kv.second);
+    }
+    return result;
+  }
+
+ private:
+  struct PortEntry {
+    uint64_t id;
+    PortRange ports;
+    RulePermission permission;
+  };
+
+  using Entries = std::vector<PortEntry>;
+
+  struct Tables {
+    CidrTree<Entries> v4;
+    CidrTree<Entries> v6;
+  };
+
+  static uint8_t ClampedLength(const EndpointRule &rule) {
+    return std::min(rule.prefix_length, rule.network.BitLength());
+  }
+
+  CidrTree<Entries> &Tree(const std::string &application,
+                          IpAddress::Family family) {
+    auto &tables = tables_[application];
+    return family == IpAddress::Family::V4 ? tables.v4 : tables.v6;
+  }
+
+  std::unordered_map<uint64_t, EndpointRule> rules_;
+  std::unordered_map<std::string, Tables> tables_;
+};
+
+}  // namespace nf
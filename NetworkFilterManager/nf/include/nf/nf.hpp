@@ -24,6 +24,8 @@
 
 #include <nf/nf.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <mutex>
@@ -34,8 +36,15 @@
 #include <vector>
 
 #include <mcom/dispatch.hpp>
+#include <mcom/file_path.hpp>
+#include <mcom/string.hpp>
 #include <mcom/sync.hpp>
 
+#include <nf/domain.hpp>
+#include <nf/endpoint.hpp>
+#include <nf/path_trie.hpp>
+#include <nf/schedule.hpp>
+
 namespace nf {
 
 enum class FilterMode { AllAllow, AllDeny, UnknownAllow, UnknownDeny, Wait };
@@ -68,8 +77,11 @@ constexpr RulePermission RulePermissionForMode(FilterMode mode) {
 
 class Application {
  public:
+  // The path is normalized lexically, so that different spellings of it
+  // share rules and cache entries
   Application(std::string_view path)
-      : path_{std::make_shared<const std::string>(path)} {}
+      : path_{
+            std::make_shared<const std::string>(mcom::NormalizePath(path))} {}
 
   const std::string &Path() const { return *path_; }
 
@@ -109,6 +121,18 @@ inline bool operator==(const Application &lhs, const Application &rhs) {
 
 using Time = std::chrono::system_clock::time_point;
 
+// A rule whose application path ends with "/*" covers every executable in
+// that directory and below it, e.g. "/usr/local/bin/*" or
+// "/Applications/Foo.app/*".
+inline bool IsPrefixRulePath(std::string_view path) {
+  return mcom::HasSuffix(path, "/*");
+}
+
+// Directory covered by a prefix rule path
+inline std::string_view PrefixRuleDirectory(std::string_view path) {
+  return path.substr(0, path.size() - 1);
+}
+
 using RuleId = uint64_t;
 
 class Rule {
@@ -210,9 +234,29 @@ struct RulesUpdate {
   std::vector<RuleId> removed;
 };
 
+// How FilterMode::Wait treats applications waiting for the user's answer.
+struct PromptPolicy {
+  // Parked flows are released with the default verdict when the user doesn't
+  // answer in time. No rule is created in that case.
+  std::chrono::seconds timeout{60};
+  RulePermission default_verdict = RulePermission::Allow;
+
+  // Flows of an application beyond this many get the default verdict
+  // immediately instead of being parked. With 0 no flow is parked and the
+  // user isn't asked.
+  size_t max_parked_flows = 256;
+};
+
+struct PendingPrompt {
+  class Application application;
+  size_t parked_flows;
+  Time asked_at;
+};
+
 using AccessCheckCompletion = std::function<void(AccessStatus)>;
 using AccessCheckHandler = std::function<AccessStatus(
-    const nf::Application &application, AccessCheckCompletion)>;
+    const nf::Application &application, const std::optional<Endpoint> &remote,
+    AccessCheckCompletion)>;
 
 template <class Callback>
 class RulesStorage {
@@ -222,50 +266,57 @@ class RulesStorage {
 
   RulesStorage &operator=(RulesStorage &&) = delete;
 
-  void UpdateRule(Rule rule) {
+  // Returns the rule as stored, with its id assigned.
+  Rule UpdateRule(Rule rule) {
     auto guard = lock_.Lock();
 
-    if (rule.Id() == 0) {
-      // check if a rule for the same application exists
-      auto it = std::find_if(rules_.begin(), rules_.end(), [&](auto &kv) {
-        return rule.Application().Path() == kv.second.Application().Path();
-      });
-      if (it == rules_.end()) {
-        rule = rule.WithId(last_id_++);
-      } else {
-        const auto &found_rule = it->second;
-        rule = found_rule.WithPermission(rule.Permission());
-      }
-    }
+    rule = Store(std::move(rule));
+    UpdateCompleted(rule);
+    return rule;
+  }
 
-    // update rules list
-    auto emplace_result = rules_.emplace(rule.Id(), rule);
-    if (!emplace_result.second) {
-      emplace_result.first->second = rule;
-    }
+  // Stores many rules under one lock, e.g. when the filter starts. Returns
+  // the rules as stored.
+  std::vector<Rule> Load(std::vector<Rule> rules) {
+    auto guard = lock_.Lock();
 
-    if (!client_connected_) {
-      return;
+    rules_.reserve(rules_.size() + rules.size());
+    exact_index_.reserve(exact_index_.size() + rules.size());
+
+    for (auto &rule : rules) {
+      rule = Store(std::move(rule));
+      UpdateCompleted(rule);
     }
+    return rules;
+  }
 
-    if (in_progress_) {
-      pending_update_.updated.insert(rule.Id());
-    } else {
-      in_progress_ = true;
-      SendUpdate(CollectChanges({{rule.Id()}, {}}));
+  std::vector<Rule> Rules() const {
+    auto guard = lock_.Lock();
+
+    std::vector<Rule> rules;
+    rules.reserve(rules_.size());
+    for (auto &kv : rules_) {
+      rules.push_back(kv.second);
     }
+    return rules;
   }
 
-  void RemoveRule(RuleId rule_id) {
+  // Returns the removed rule, if there was one.
+  std::optional<Rule> RemoveRule(RuleId rule_id) {
     auto guard = lock_.Lock();
 
     // update rules list
-    if (0 == rules_.erase(rule_id)) {
-      return;
+    auto it = rules_.find(rule_id);
+    if (it == rules_.end()) {
+      return std::nullopt;
     }
 
+    Rule removed = it->second;
+    Unindex(removed);
+    rules_.erase(it);
+
     if (!client_connected_) {
-      return;
+      return removed;
     }
 
     if (in_progress_) {
@@ -275,6 +326,8 @@ class RulesStorage {
       in_progress_ = true;
       SendUpdate(CollectChanges({{}, {rule_id}}));
     }
+
+    return removed;
   }
 
   template <class Fn>
@@ -286,7 +339,9 @@ class RulesStorage {
       return;
     }
 
+    Unindex(it->second);
     fn(it->second);
+    Index(it->second);
 
     if (!client_connected_) {
       return;
@@ -312,6 +367,22 @@ class RulesStorage {
     return it->second;
   }
 
+  // Rule for the executable at path: a rule for exactly that path, otherwise
+  // the prefix rule with the longest directory containing it.
+  std::optional<Rule> MatchingPath(const std::string &path) const {
+    auto guard = lock_.Lock();
+
+    if (auto it = exact_index_.find(path); it != exact_index_.end()) {
+      return rules_.at(it->second);
+    }
+
+    if (auto rule_id = prefix_index_.LongestPrefix(path)) {
+      return rules_.at(*rule_id);
+    }
+
+    return std::nullopt;
+  }
+
   void ClientConnected() {
     auto guard = lock_.Lock();
 
@@ -339,6 +410,66 @@ class RulesStorage {
     bool IsEmpty() const { return updated.empty() && removed.empty(); }
   };
 
+  // Gives a new rule an id, or the id of the existing rule for the same
+  // application, and indexes it.
+  Rule Store(Rule rule) {
+    if (rule.Id() == 0) {
+      // check if a rule for the same application exists
+      auto it = exact_index_.find(rule.Application().Path());
+      if (it == exact_index_.end()) {
+        rule = rule.WithId(last_id_++);
+      } else {
+        const auto &found_rule = rules_.at(it->second);
+        rule = found_rule.WithPermission(rule.Permission());
+      }
+    } else if (rule.Id() >= last_id_) {
+      // Rules loaded with their ids must not collide with new ones
+      last_id_ = rule.Id() + 1;
+    }
+
+    // update rules list
+    auto emplace_result = rules_.emplace(rule.Id(), rule);
+    if (!emplace_result.second) {
+      Unindex(emplace_result.first->second);
+      emplace_result.first->second = rule;
+    }
+    Index(rule);
+
+    return rule;
+  }
+
+  void Index(const Rule &rule) {
+    const auto &path = rule.Application().Path();
+    exact_index_[path] = rule.Id();
+    if (IsPrefixRulePath(path)) {
+      prefix_index_.Insert(PrefixRuleDirectory(path), rule.Id());
+    }
+  }
+
+  void Unindex(const Rule &rule) {
+    const auto &path = rule.Application().Path();
+    auto it = exact_index_.find(path);
+    if (it != exact_index_.end() && it->second == rule.Id()) {
+      exact_index_.erase(it);
+      if (IsPrefixRulePath(path)) {
+        prefix_index_.Erase(PrefixRuleDirectory(path));
+      }
+    }
+  }
+
+  void UpdateCompleted(const Rule &rule) {
+    if (!client_connected_) {
+      return;
+    }
+
+    if (in_progress_) {
+      pending_update_.updated.insert(rule.Id());
+    } else {
+      in_progress_ = true;
+      SendUpdate(CollectChanges({{rule.Id()}, {}}));
+    }
+  }
+
   void SendUpdate(RulesUpdate changes) {
     auto no_reply = Deferred::Shared([this]() {
       dispatch::Queue{}.Async([this]() { DidSendUpdate(false); });
@@ -410,9 +541,12 @@ class RulesStorage {
     return changes;
   }
 
-  mutable dispatch::Semaphore lock_{1};
+  mutable dispatch::Semaphore lock_{1, "nf.RulesStorage"};
   std::atomic<RuleId> last_id_{1};
   std::unordered_map<RuleId, Rule> rules_;
+  // Application path -> rule id, prefix rules included under their "/*" path
+  std::unordered_map<std::string, RuleId> exact_index_;
+  PathTrie<RuleId> prefix_index_;
   bool client_connected_ = false;
   bool client_reconnected_ = false;
   bool in_progress_ = false;
@@ -489,6 +623,219 @@ class PacketQueue {
   PacketList list_;
 };
 
+// What CheckAccess does with a flow, worked out ahead of time from the
+// matching rule (if any) and the filter mode.
+struct Decision {
+  enum class Action : uint8_t {
+    None,
+    // Update the rule's access time
+    RecordAccess,
+    // Add a rule for the application with new_rule_permission
+    CreateRule,
+    // Park the flow until the user answers
+    AskUser,
+  };
+
+  AccessStatus status;
+  Action action;
+  RulePermission new_rule_permission;
+};
+
+constexpr Decision DecisionForRule(FilterMode mode,
+                                   RulePermission permission) {
+  if (mode == FilterMode::AllAllow) {
+    return {AccessStatus::Allow, Decision::Action::None, permission};
+  }
+
+  return {ToAccessStatus(permission),
+          permission == RulePermission::Allow ? Decision::Action::RecordAccess
+                                              : Decision::Action::None,
+          permission};
+}
+
+constexpr Decision DecisionForUnknown(FilterMode mode) {
+  if (mode == FilterMode::Wait) {
+    return {AccessStatus::Wait, Decision::Action::AskUser,
+            RulePermission::Allow};
+  }
+
+  const auto permission = RulePermissionForMode(mode);
+  return {ToAccessStatus(permission), Decision::Action::CreateRule,
+          permission};
+}
+
+// Application rules compiled into decisions, indexed the same way as in
+// RulesStorage. Decisions are recomputed when a rule or the mode changes,
+// so a lookup is a hash probe (or a trie walk for prefix rules) and reading
+// the stored record. A scheduled rule also has a decision for the time
+// outside its windows; which one applies is cached until the schedule's
+// next transition.
+class DecisionTable {
+ public:
+  struct Verdict {
+    Decision decision;
+    RuleId rule_id;
+    // Set the first time a rule is hit after its access time was last
+    // written back, so that the caller schedules the write-back once.
+    bool first_access;
+  };
+
+  explicit DecisionTable(FilterMode mode)
+      : mode_{mode}, unknown_{DecisionForUnknown(mode)} {}
+
+  void SetMode(FilterMode mode) {
+    mode_ = mode;
+    unknown_ = DecisionForUnknown(mode);
+    for (auto &kv : entries_) {
+      Compile(kv.second);
+    }
+  }
+
+  // Kept apart from the rules, so a schedule may arrive before its rule and
+  // survives updates of the rule.
+  void SetSchedule(const RuleSchedule &schedule) {
+    schedules_.insert_or_assign(schedule.rule_id, schedule);
+    if (auto entry = FindEntry(schedule.rule_id)) {
+      Compile(*entry);
+    }
+  }
+
+  void RemoveSchedule(RuleId rule_id) {
+    if (schedules_.erase(rule_id) != 0) {
+      if (auto entry = FindEntry(rule_id)) {
+        Compile(*entry);
+      }
+    }
+  }
+
+  std::vector<RuleSchedule> Schedules() const {
+    std::vector<RuleSchedule> result;
+    result.reserve(schedules_.size());
+    for (auto &kv : schedules_) {
+      result.push_back(kv.second);
+    }
+    return result;
+  }
+
+  void Update(const Rule &rule) {
+    Remove(rule.Id());
+
+    const auto &path = rule.Application().Path();
+    auto &entry = entries_[path];
+    if (entry.id != rule.Id()) {
+      // The slot held another rule for the same path; nothing of its state
+      // carries over
+      entry.accessed.store(false, std::memory_order_relaxed);
+      entry.schedule_cache.Invalidate();
+    }
+    entry.id = rule.Id();
+    entry.permission = rule.Permission();
+    Compile(entry);
+
+    if (IsPrefixRulePath(path)) {
+      prefixes_.Insert(PrefixRuleDirectory(path), &entry);
+    }
+    paths_[rule.Id()] = path;
+  }
+
+  void Remove(RuleId rule_id) {
+    auto path = paths_.find(rule_id);
+    if (path == paths_.end()) {
+      return;
+    }
+
+    auto entry = entries_.find(path->second);
+    if (entry != entries_.end() && entry->second.id == rule_id) {
+      if (IsPrefixRulePath(path->second)) {
+        prefixes_.Erase(PrefixRuleDirectory(path->second));
+      }
+      entries_.erase(entry);
+    }
+    paths_.erase(path);
+  }
+
+  // Safe to call concurrently with other lookups.
+  Verdict Lookup(const std::string &path) const {
+    const Entry *entry = nullptr;
+    if (auto it = entries_.find(path); it != entries_.end()) {
+      entry = &it->second;
+    } else if (auto prefix_entry = prefixes_.LongestPrefix(path)) {
+      entry = *prefix_entry;
+    }
+
+    if (!entry) {
+      return {unknown_, 0, false};
+    }
+
+    const Decision *decision = &entry->decision;
+    if (entry->schedule &&
+        !entry->schedule_cache.Active(entry->schedule->windows,
+                                      std::time(nullptr))) {
+      decision = &entry->outside_decision;
+    }
+
+    bool first_access = false;
+    if (decision->action == Decision::Action::RecordAccess &&
+        !entry->accessed.load(std::memory_order_relaxed)) {
+      first_access = !entry->accessed.exchange(true, std::memory_order_relaxed);
+    }
+    return {*decision, entry->id, first_access};
+  }
+
+  // Lets the next hit of the rule report a first access again.
+  void AccessRecorded(RuleId rule_id) const {
+    if (auto entry = FindEntry(rule_id)) {
+      entry->accessed.store(false, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  struct Entry {
+    RuleId id = 0;
+    RulePermission permission = RulePermission::Allow;
+    Decision decision{};
+    mutable std::atomic<bool> accessed{false};
+
+    const RuleSchedule *schedule = nullptr;
+    Decision outside_decision{};
+    ScheduleCache schedule_cache;
+  };
+
+  void Compile(Entry &entry) const {
+    entry.decision = DecisionForRule(mode_, entry.permission);
+
+    auto schedule = schedules_.find(entry.id);
+    entry.schedule = schedule != schedules_.end() ? &schedule->second : nullptr;
+    if (entry.schedule) {
+      entry.outside_decision =
+          DecisionForRule(mode_, entry.schedule->outside_permission);
+      entry.schedule_cache.Invalidate();
+    }
+  }
+
+  Entry *FindEntry(RuleId rule_id) const {
+    auto path = paths_.find(rule_id);
+    if (path == paths_.end()) {
+      return nullptr;
+    }
+
+    auto entry = entries_.find(path->second);
+    if (entry == entries_.end() || entry->second.id != rule_id) {
+      return nullptr;
+    }
+    return const_cast<Entry *>(&entry->second);
+  }
+
+  FilterMode mode_;
+  Decision unknown_;
+  // Nodes of an unordered_map don't move, so the trie can point into it
+  std::unordered_map<std::string, Entry> entries_;
+  PathTrie<Entry *> prefixes_;
+  std::unordered_map<RuleId, std::string> paths_;
+  // Node-based as well: entries point at their schedules
+  std::unordered_map<RuleId, RuleSchedule> schedules_;
+};
+
 template <class Delegate, class RulesStorage>
 class NetworkFilter {
  public:
@@ -498,95 +845,285 @@ class NetworkFilter {
                 RulesStorage &&rules)
       : mode_{mode},
         delegate_{delegate},
-        rules_{std::forward<RulesStorage>(rules)} {
-    for (auto &rule : initial_rules) {
-      rules_->UpdateRule(std::move(rule));
-    }
+        rules_{std::forward<RulesStorage>(rules)},
+        decisions_{mcom::LockName{"nf.decisions"}, mode} {
+    decisions_.Use([&](auto &decisions) {
+      for (auto &rule : rules_->Load(std::move(initial_rules))) {
+        decisions.Update(rule);
+      }
+    });
   }
 
   NetworkFilter &operator=(NetworkFilter &&) = delete;
 
-  void SetMode(FilterMode mode) noexcept { mode_ = mode; }
+  void SetMode(FilterMode mode) noexcept {
+    decisions_.Use([&](auto &decisions) {
+      mode_ = mode;
+      decisions.SetMode(mode);
+    });
+  }
 
   FilterMode GetMode() const noexcept { return mode_; }
 
-  void UpdateRule(Rule rule) noexcept { rules_->UpdateRule(rule); }
+  // The storage and the decision table change under the table's lock, so
+  // that they can't end up holding different versions of a rule.
+  void UpdateRule(Rule rule) noexcept {
+    decisions_.Use(
+        [&](auto &decisions) { decisions.Update(rules_->UpdateRule(rule)); });
+  }
+
+  void RemoveRule(uint64_t rule_id) noexcept {
+    decisions_.Use([&](auto &decisions) {
+      rules_->RemoveRule(rule_id);
+      decisions.Remove(rule_id);
+      decisions.RemoveSchedule(rule_id);
+    });
+  }
+
+  void SetRuleSchedule(const RuleSchedule &schedule) {
+    decisions_.Use([&](auto &decisions) { decisions.SetSchedule(schedule); });
+  }
+
+  void RemoveRuleSchedule(RuleId rule_id) {
+    decisions_.Use([&](auto &decisions) { decisions.RemoveSchedule(rule_id); });
+  }
+
+  RulesList Rules() const { return rules_->Rules(); }
+
+  std::vector<RuleSchedule> RuleSchedules() const {
+    return decisions_.UseShared(
+        [](auto &decisions) { return decisions.Schedules(); });
+  }
+
+  void UpdateEndpointRule(const EndpointRule &rule) {
+    endpoint_rules_.Use([&](auto &rules) { rules.Update(rule); });
+  }
 
-  void RemoveRule(uint64_t rule_id) noexcept { rules_->RemoveRule(rule_id); }
+  void RemoveEndpointRule(uint64_t rule_id) {
+    endpoint_rules_.Use([&](auto &rules) { rules.Remove(rule_id); });
+  }
+
+  std::vector<EndpointRule> EndpointRulesList() const {
+    return endpoint_rules_.UseShared([](auto &rules) { return rules.Rules(); });
+  }
+
+  // Returns false if the rule's pattern is malformed.
+  bool UpdateDomainRule(const DomainRule &rule) {
+    return domain_rules_.Use([&](auto &rules) { return rules.Update(rule); });
+  }
+
+  void RemoveDomainRule(uint64_t rule_id) {
+    domain_rules_.Use([&](auto &rules) { rules.Remove(rule_id); });
+  }
+
+  std::vector<DomainRule> DomainRulesList() const {
+    return domain_rules_.UseShared([](auto &rules) { return rules.Rules(); });
+  }
 
   template <class Completion>
   AccessStatus CheckAccess(const Application &application,
+                           const std::optional<Endpoint> &remote,
                            Completion &&completion) noexcept {
-    if (auto rule = RuleMatchingApplication(application)) {
-      if (mode_ == FilterMode::AllAllow) {
-        return AccessStatus::Allow;
+    if (remote && mode_ != FilterMode::AllAllow) {
+      // Domain rules apply to every application
+      if (!remote->hostname.empty()) {
+        auto permission = domain_rules_.UseShared([&](auto &rules) {
+          return rules.Match(remote->hostname);
+        });
+        if (permission) {
+          return ToAccessStatus(*permission);
+        }
       }
 
-      const auto access_status = ToAccessStatus(rule->Permission());
-      if (access_status == AccessStatus::Allow) {
-        UpdateRuleAccessTime(rule->Id());
+      // An endpoint rule overrides the application's rule for its network
+      auto permission = endpoint_rules_.UseShared([&](auto &rules) {
+        return rules.Empty() ? std::nullopt
+                             : rules.Match(application.Path(), *remote);
+      });
+      if (permission) {
+        return ToAccessStatus(*permission);
       }
-      return access_status;
     }
 
-    if (mode_ == FilterMode::Wait) {
-      auto &path = application.Path();
-
-      const auto should_ask = completions_.Use([&](auto &completions) -> bool {
-        auto insert_result = completions.insert({path, {}});
+    return CheckAccess(application, std::forward<Completion>(completion));
+  }
 
-        insert_result.first->second.emplace_back(
-            std::forward<Completion>(completion));
+  template <class Completion>
+  AccessStatus CheckAccess(const Application &application,
+                           Completion &&completion) noexcept {
+    const auto verdict = decisions_.UseShared([&](auto &decisions) {
+      return decisions.Lookup(application.Path());
+    });
+    const auto &decision = verdict.decision;
 
-        return insert_result.second;
-      });
+    switch (decision.action) {
+      case Decision::Action::None:
+        break;
 
-      if (should_ask) {
-        auto lambda = [this, path](AccessStatus permission) {
-          completions_.Use([&](auto &completions) {
-            for (auto &completion : completions[path]) {
-              completion(permission);
-            }
-            completions.erase(path);
-          });
-        };
-
-        auto shared_completion =
-            std::make_shared<decltype(lambda)>(std::move(lambda));
-
-        auto caller = Deferred::Shared([shared_completion]() {
-          (*shared_completion)(AccessStatus::Allow);
-        });
+      case Decision::Action::RecordAccess:
+        if (verdict.first_access) {
+          RecordAccess(verdict.rule_id);
+        }
+        break;
 
-        delegate_.AskPermission(
-            application, [=](nf::RulePermission permission) mutable {
-              caller->Cancel();
-              const auto access_status =
-                  AccessStatusWithNewRule(permission, application);
-              (*shared_completion)(access_status);
-            });
-      }
+      case Decision::Action::CreateRule:
+        return AccessStatusWithNewRule(decision.new_rule_permission,
+                                       application);
 
-      return AccessStatus::Wait;
+      case Decision::Action::AskUser:
+        return WaitForPrompt(application,
+                             std::forward<Completion>(completion));
     }
 
-    return AccessStatusWithNewRule(RulePermissionForMode(mode_), application);
+    return decision.status;
+  }
+
+  void SetPromptPolicy(const PromptPolicy &policy) {
+    prompt_policy_.Use([&](auto &prompt_policy) { prompt_policy = policy; });
+  }
+
+  PromptPolicy GetPromptPolicy() const {
+    return prompt_policy_.UseShared([](auto &policy) { return policy; });
+  }
+
+  // Applications currently waiting for the user's answer.
+  std::vector<PendingPrompt> PendingPrompts() const {
+    std::vector<PendingPrompt> result;
+    completions_.ForEachShard([&](auto &prompts) {
+      for (auto &kv : prompts) {
+        auto &prompt = kv.second;
+        result.push_back({prompt.application, prompt.completions.size(),
+                          prompt.asked_at});
+      }
+    });
+    return result;
   }
 
   std::optional<Rule> RuleMatchingApplication(
       const Application &application) const noexcept {
-    return rules_->Matching([&](auto &rule) {
-      return rule.Application().Path() == application.Path();
-    });
+    return rules_->MatchingPath(application.Path());
   }
 
   Time CurrentTime() const { return delegate_.CurrentTime(); }
 
  private:
-  void UpdateRuleAccessTime(RuleId rule_id) {
-    rules_->ModifyInPlace(rule_id, [time = CurrentTime()](auto &rule) {
-      rule = rule.WithAccessTime(time);
+  struct Prompt {
+    // Distinguishes successive prompts for the same application, so that an
+    // answer arriving after the timeout doesn't release newer flows.
+    uint64_t generation;
+    class Application application;
+    Time asked_at;
+    std::vector<AccessCheckCompletion> completions;
+  };
+
+  template <class Completion>
+  AccessStatus WaitForPrompt(const Application &application,
+                             Completion &&completion) {
+    const auto policy = GetPromptPolicy();
+    auto &path = application.Path();
+
+    std::optional<uint64_t> new_generation;
+    const bool parked = completions_.Use(path, [&](auto &prompts) {
+      auto it = prompts.find(path);
+      const size_t parked_flows =
+          it == prompts.end() ? 0 : it->second.completions.size();
+      if (parked_flows >= policy.max_parked_flows) {
+        return false;
+      }
+
+      if (it == prompts.end()) {
+        new_generation = next_prompt_generation_++;
+        it = prompts
+                 .emplace(path, Prompt{*new_generation, application,
+                                       CurrentTime(), {}})
+                 .first;
+      }
+
+      it->second.completions.emplace_back(std::forward<Completion>(completion));
+      return true;
     });
+
+    if (!parked) {
+      return ToAccessStatus(policy.default_verdict);
+    }
+
+    if (new_generation) {
+      AskPermission(application, *new_generation, policy);
+    }
+
+    return AccessStatus::Wait;
+  }
+
+  void AskPermission(const Application &application, uint64_t generation,
+                     const PromptPolicy &policy) {
+    const auto default_status = ToAccessStatus(policy.default_verdict);
+    const std::string path = application.Path();
+
+    // Fires if the client drops the request without answering
+    auto caller = Deferred::Shared([this, path, generation, default_status]() {
+      ResolvePrompt(path, generation, default_status);
+    });
+
+    dispatch::Queue{}.After(
+        dispatch::Time::Now() + dispatch::Duration::Seconds(
+                                    std::max<int64_t>(policy.timeout.count(), 0)),
+        [this, path, generation, default_status]() {
+          ResolvePrompt(path, generation, default_status);
+        });
+
+    delegate_.AskPermission(
+        application, [=](nf::RulePermission permission) mutable {
+          caller->Cancel();
+          const auto access_status =
+              AccessStatusWithNewRule(permission, application);
+          ResolvePrompt(path, generation, access_status);
+        });
+  }
+
+  void ResolvePrompt(const std::string &path, uint64_t generation,
+                     AccessStatus status) {
+    std::vector<AccessCheckCompletion> completions;
+
+    completions_.Use(path, [&](auto &prompts) {
+      auto it = prompts.find(path);
+      if (it == prompts.end() || it->second.generation != generation) {
+        return;
+      }
+      completions = std::move(it->second.completions);
+      prompts.erase(it);
+    });
+
+    for (auto &completion : completions) {
+      completion(status);
+    }
+  }
+
+  // Access times are written back to the storage in batches: every rule
+  // hit since the last batch gets the time of the batch.
+  void RecordAccess(RuleId rule_id) {
+    const bool schedule = accessed_rules_.Use([&](auto &rule_ids) {
+      rule_ids.push_back(rule_id);
+      return rule_ids.size() == 1;
+    });
+
+    if (schedule) {
+      dispatch::Queue{}.After(
+          dispatch::Time::Now() + dispatch::Duration::Seconds(1),
+          [this]() { WriteAccessTimes(); });
+    }
+  }
+
+  void WriteAccessTimes() {
+    std::vector<RuleId> rule_ids;
+    accessed_rules_.Use([&](auto &accessed) { std::swap(rule_ids, accessed); });
+
+    const auto time = CurrentTime();
+    for (auto rule_id : rule_ids) {
+      decisions_.UseShared(
+          [&](auto &decisions) { decisions.AccessRecorded(rule_id); });
+      rules_->ModifyInPlace(
+          rule_id, [&](auto &rule) { rule = rule.WithAccessTime(time); });
+    }
   }
 
   AccessStatus AccessStatusWithNewRule(RulePermission permission,
@@ -612,9 +1149,17 @@ class NetworkFilter {
   Delegate &delegate_;
   RulesStorage rules_;
 
-  mcom::Sync<
-      std::unordered_map<std::string, std::vector<AccessCheckCompletion>>>
-      completions_;
+  mcom::SharedSync<DecisionTable> decisions_;
+  mcom::Sync<std::vector<RuleId>> accessed_rules_;
+
+  mcom::SharedSync<DomainRules> domain_rules_{
+      mcom::LockName{"nf.domain_rules"}};
+  mcom::SharedSync<EndpointRules> endpoint_rules_{
+      mcom::LockName{"nf.endpoint_rules"}};
+
+  mcom::SharedSync<PromptPolicy> prompt_policy_;
+  std::atomic<uint64_t> next_prompt_generation_{1};
+  mcom::ShardedSync<std::string, Prompt> completions_;
 };
 
 constexpr std::optional<Time> FromTimeT(std::time_t value) {
@@ -0,0 +1,191 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mcom/file_path.hpp>
+
+namespace nf {
+
+// Splits a path into its non-empty components: "/usr//local/" gives
+// {"usr", "local"}.
+inline std::vector<std::string_view> PathComponents(std::string_view path) {
+  const auto components = mcom::FilePathView{path}.Components();
+  return {components.begin(), components.end()};
+}
+
+// Maps directory prefixes to values and finds the longest prefix of a path
+// that has a value. Matching is done on whole path components, so
+// "/usr/local" is a prefix of "/usr/local/bin/tool" and of "/usr/local"
+// itself but not of "/usr/localized". Chains of nodes with a single child
+// are compressed into one edge, so a lookup costs one map search per branch
+// point on the way down.
+template <class Value>
+class PathTrie {
+ public:
+  void Insert(std::string_view prefix, Value value) {
+    const auto components = PathComponents(prefix);
+
+    Node *node = &root_;
+    size_t index = 0;
+
+    while (index < components.size()) {
+      auto it = node->children.find(components[index]);
+      if (it == node->children.end()) {
+        auto child = std::make_unique<Node>();
+        child->label.assign(components.begin() + index, components.end());
+        child->value.emplace(std::move(value));
+        node->children.emplace(components[index], std::move(child));
+        return;
+      }
+
+      auto &child = it->second;
+      const size_t common = CommonLength(child->label, components, index);
+
+      if (common < child->label.size()) {
+        // Split the edge at the point where the paths diverge
+        auto middle = std::make_unique<Node>();
+        middle->label.assign(child->label.begin(),
+                             child->label.begin() + common);
+        child->label.erase(child->label.begin(),
+                           child->label.begin() + common);
+        auto key = child->label.front();
+        middle->children.emplace(std::move(key), std::move(child));
+        child = std::move(middle);
+      }
+
+      index += common;
+      node = child.get();
+    }
+
+    node->value.emplace(std::move(value));
+  }
+
+  // Returns true if the prefix had a value.
+  bool Erase(std::string_view prefix) {
+    const auto components = PathComponents(prefix);
+    return Erase(root_, components, 0);
+  }
+
+  // Walks the components of `path` in place, without splitting it first
+  const Value *LongestPrefix(std::string_view path) const {
+    const auto components = mcom::FilePathView{path}.Components();
+    auto component = components.begin();
+
+    const Node *node = &root_;
+    const Value *best = node->value ? &*node->value : nullptr;
+
+    while (component != components.end()) {
+      auto it = node->children.find(*component);
+      if (it == node->children.end()) {
+        break;
+      }
+
+      for (const auto &label_component : it->second->label) {
+        if (component == components.end() || *component != label_component) {
+          return best;
+        }
+        ++component;
+      }
+
+      node = it->second.get();
+      if (node->value) {
+        best = &*node->value;
+      }
+    }
+
+    return best;
+  }
+
+  void Clear() {
+    root_.children.clear();
+    root_.value.reset();
+  }
+
+  bool Empty() const { return !root_.value && root_.children.empty(); }
+
+ private:
+  struct Node {
+    // Components on the edge leading to this node
+    std::vector<std::string> label;
+    std::optional<Value> value;
+    std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+  };
+
+  static size_t CommonLength(const std::vector<std::string> &label,
+                             const std::vector<std::string_view> &components,
+                             size_t index) {
+    size_t length = 0;
+    while (length < label.size() && index + length < components.size() &&
+           label[length] == components[index + length]) {
+      ++length;
+    }
+    return length;
+  }
+
+  static bool Erase(Node &node, const std::vector<std::string_view> &components,
+                    size_t index) {
+    if (index == components.size()) {
+      if (!node.value) {
+        return false;
+      }
+      node.value.reset();
+      return true;
+    }
+
+    auto it = node.children.find(components[index]);
+    if (it == node.children.end()) {
+      return false;
+    }
+
+    auto &child = it->second;
+    if (CommonLength(child->label, components, index) < child->label.size()) {
+      return false;
+    }
+
+    if (!Erase(*child, components, index + child->label.size())) {
+      return false;
+    }
+
+    if (!child->value) {
+      if (child->children.empty()) {
+        node.children.erase(it);
+      } else if (child->children.size() == 1) {
+        // Merge the child with its only descendant
+        auto grandchild = std::move(child->children.begin()->second);
+        grandchild->label.insert(grandchild->label.begin(),
+                                 child->label.begin(), child->label.end());
+        child = std::move(grandchild);
+      }
+    }
+
+    return true;
+  }
+
+  Node root_;
+};
+
+}  // namespace nf
@@ -0,0 +1,132 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+namespace nf {
+
+enum class RulePermission;
+
+// Part of the week in local time: from begin_minute to end_minute past
+// midnight on each day in days (bit 0 is Sunday). A window whose end is not
+// after its begin runs over midnight into the next day.
+struct TimeWindow {
+  uint8_t days;
+  uint16_t begin_minute;
+  uint16_t end_minute;
+};
+
+// Limits a rule to the given windows; outside of them the rule's
+// application gets outside_permission instead.
+struct RuleSchedule {
+  uint64_t rule_id;
+  std::vector<TimeWindow> windows;
+  RulePermission outside_permission;
+};
+
+struct ScheduleState {
+  bool active;
+  // The state holds until this time
+  std::time_t next_transition;
+};
+
+namespace schedule_internal {
+
+inline std::time_t LocalTime(const std::tm &today, int day_offset,
+                             int minute) {
+  std::tm tm = today;
+  tm.tm_mday += day_offset;
+  tm.tm_hour = 0;
+  tm.tm_min = minute;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  return std::mktime(&tm);
+}
+
+}  // namespace schedule_internal
+
+// Calendar math; meant to run only when a cached state expires.
+inline ScheduleState EvaluateSchedule(const std::vector<TimeWindow> &windows,
+                                      std::time_t now) {
+  using schedule_internal::LocalTime;
+
+  std::tm today;
+  ::localtime_r(&now, &today);
+
+  ScheduleState state{false, now + 7 * 24 * 60 * 60};
+
+  // A window that started yesterday may still be open, and every window
+  // recurs within a week
+  for (int day_offset = -1; day_offset <= 7; ++day_offset) {
+    const int weekday = ((today.tm_wday + day_offset) % 7 + 7) % 7;
+
+    for (auto &window : windows) {
+      if (!(window.days & (1 << weekday))) {
+        continue;
+      }
+
+      const bool overnight = window.end_minute <= window.begin_minute;
+      const auto begin = LocalTime(today, day_offset, window.begin_minute);
+      const auto end =
+          LocalTime(today, day_offset + overnight, window.end_minute);
+
+      if (begin <= now && now < end) {
+        state.active = true;
+      }
+      for (auto transition : {begin, end}) {
+        if (transition > now) {
+          state.next_transition = std::min(state.next_transition, transition);
+        }
+      }
+    }
+  }
+
+  return state;
+}
+
+// A schedule's state cached in one word, so that checking it on the hot
+// path is a load and a comparison. Concurrent refreshes compute the same
+// value, so they may race.
+class ScheduleCache {
+ public:
+  bool Active(const std::vector<TimeWindow> &windows, std::time_t now) const {
+    const auto cached = state_.load(std::memory_order_relaxed);
+    if (now < (cached >> 1)) {
+      return cached & 1;
+    }
+
+    const auto state = EvaluateSchedule(windows, now);
+    state_.store((int64_t(state.next_transition) << 1) | state.active,
+                 std::memory_order_relaxed);
+    return state.active;
+  }
+
+  void Invalidate() { state_.store(0, std::memory_order_relaxed); }
+
+ private:
+  mutable std::atomic<int64_t> state_{0};
+};
+
+}  // namespace nf
@@ -65,7 +65,7 @@ class nf_manager {
       const nf_rule_enumerator_options_t &options) const {
     std::vector<nf::Rule> rules;
 
-    rules_.Use([&](auto &rules_) {
+    rules_.UseShared([&](const auto &rules_) {
       for (const auto &kv : rules_) {
         auto &rule = kv.second;
 
@@ -82,7 +82,7 @@ class nf_manager {
   }
 
  private:
-  mcom::Sync<std::unordered_map<nf::RuleId, nf::Rule>> rules_;
+  mcom::SharedSync<std::unordered_map<nf::RuleId, nf::Rule>> rules_;
 };
 
 class nf_statistics_store {
@@ -190,7 +190,7 @@ class nf_statistics_store {
   };
 
   std::unordered_map<std::string, StatisticData> statistic_;
-  dispatch::Semaphore statistic_lock_{1};
+  dispatch::Semaphore statistic_lock_{1, "nf.statistics"};
 };
 
 class nf_rules_iterator {
@@ -23,6 +23,9 @@
 #include "message.hpp"
 
 #include <string>
+#include <vector>
+
+#include <mcom/sync.hpp>
 
 namespace {
 
@@ -40,19 +43,114 @@ const std::error_category &error_category() noexcept {
   return ecat;
 }
 
+namespace message_details {
+
+struct BufferPool {
+  BufferPool(size_t buffer_size, size_t capacity)
+      : buffer_size{buffer_size}, capacity{capacity} {
+    free_buffers.AccessUnsafely().reserve(capacity);
+  }
+
+  ~BufferPool() {
+    for (auto buffer : free_buffers.AccessUnsafely()) {
+      std::free(buffer);
+    }
+  }
+
+  void *Acquire() {
+    void *buffer = free_buffers.Use([](auto &buffers) -> void * {
+      if (buffers.empty()) {
+        return nullptr;
+      }
+      auto buffer = buffers.back();
+      buffers.pop_back();
+      return buffer;
+    });
+
+    return buffer ? buffer : std::malloc(buffer_size);
+  }
+
+  void Release(void *buffer) {
+    const bool cached = free_buffers.Use([&](auto &buffers) {
+      if (buffers.size() >= capacity) {
+        return false;
+      }
+      buffers.push_back(buffer);
+      return true;
+    });
+
+    if (!cached) {
+      std::free(buffer);
+    }
+  }
+
+  const size_t buffer_size;
+  const size_t capacity;
+  mcom::Sync<std::vector<void *>> free_buffers;
+};
+
+}  // namespace message_details
+
+MessageBufferPool::MessageBufferPool(size_t buffer_size, size_t capacity)
+    : pool_{std::make_shared<message_details::BufferPool>(buffer_size,
+                                                          capacity)} {}
+
+size_t MessageBufferPool::BufferSize() const { return pool_->buffer_size; }
+
+void MessageBuffer::BufferDeleter::operator()(void *buffer) const {
+  if (pool) {
+    pool->Release(buffer);
+  } else {
+    std::free(buffer);
+  }
+}
+
 mcom::Result<MessageBuffer> MessageBuffer::Receive(const ReceiveRight &right,
                                                    size_t size) {
   const auto buffer_size = size + sizeof(mach_msg_audit_trailer_t);
 
-  Buffer buffer{std::malloc(buffer_size), std::free};
+  return ReceiveInto(right, Buffer{std::malloc(buffer_size), BufferDeleter{}},
+                     buffer_size);
+}
+
+mcom::Result<MessageBuffer> MessageBuffer::Receive(
+    const ReceiveRight &right, size_t size, const MessageBufferPool &pool) {
+  return ReceiveImpl(right, size, pool, 0, MACH_MSG_TIMEOUT_NONE);
+}
+
+mcom::Result<MessageBuffer> MessageBuffer::TryReceive(
+    const ReceiveRight &right, size_t size, const MessageBufferPool &pool) {
+  return ReceiveImpl(right, size, pool, MACH_RCV_TIMEOUT, 0);
+}
+
+mcom::Result<MessageBuffer> MessageBuffer::ReceiveImpl(
+    const ReceiveRight &right, size_t size, const MessageBufferPool &pool,
+    mach_msg_option_t options, mach_msg_timeout_t timeout) {
+  const auto &buffer_pool = pool.pool_;
+  const auto buffer_size = size + sizeof(mach_msg_audit_trailer_t);
+
+  if (buffer_size > buffer_pool->buffer_size) {
+    // Oversized messages get a dedicated buffer
+    return ReceiveInto(right, Buffer{std::malloc(buffer_size), BufferDeleter{}},
+                       buffer_size, options, timeout);
+  }
+
+  return ReceiveInto(right,
+                     Buffer{buffer_pool->Acquire(), BufferDeleter{buffer_pool}},
+                     buffer_pool->buffer_size, options, timeout);
+}
 
+mcom::Result<MessageBuffer> MessageBuffer::ReceiveInto(
+    const ReceiveRight &right, Buffer buffer, size_t buffer_size,
+    mach_msg_option_t options, mach_msg_timeout_t timeout) {
   auto header_ptr = static_cast<mach_msg_header_t *>(buffer.get());
 
   const auto status = ::mach_msg(
       header_ptr,
-      MACH_RCV_MSG | MACH_RCV_TRAILER_ELEMENTS(MACH_RCV_TRAILER_AUDIT), 0,
-      static_cast<mach_msg_size_t>(buffer_size), right.Name(),
-      MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+      MACH_RCV_MSG | MACH_RCV_TRAILER_ELEMENTS(MACH_RCV_TRAILER_AUDIT) |
+          options,
+      0, static_cast<mach_msg_size_t>(buffer_size), right.Name(), timeout,
+      MACH_PORT_NULL);
   if (status != 0) {
     return std::error_code{status, error_category()};
   }
@@ -62,7 +160,9 @@ mcom::Result<MessageBuffer> MessageBuffer::Receive(const ReceiveRight &right,
   return {std::move(buffer)};
 }
 
-MessageBuffer::MessageBuffer(Buffer buffer) : buffer_{std::move(buffer)} {}
+MessageBuffer::MessageBuffer(Buffer buffer)
+    : buffer_{std::move(buffer)},
+      receive_time_{std::chrono::steady_clock::now()} {}
 
 MessageBuffer::~MessageBuffer() {
   if (buffer_.get()) {
@@ -22,7 +22,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdlib>
+#include <memory>
 #include <system_error>
 #include <utility>
 
@@ -528,11 +530,47 @@ struct MessageImpl<std::index_sequence<Is...>, Ts...>
 template <class... Ts>
 struct Message : MessageImpl<std::index_sequence_for<Ts...>, Ts...> {};
 
+namespace message_details {
+
+struct BufferPool;
+
+}  // namespace message_details
+
+// A free list of fixed-size receive buffers shared by all messages received
+// through it. Buffers are returned to the pool when the owning MessageBuffer
+// is destroyed; messages larger than the pool's buffer size are received into
+// a dedicated heap allocation instead.
+class MessageBufferPool {
+ public:
+  static constexpr size_t kDefaultBufferSize = 1024;
+  static constexpr size_t kDefaultCapacity = 16;
+
+  explicit MessageBufferPool(size_t buffer_size = kDefaultBufferSize,
+                             size_t capacity = kDefaultCapacity);
+
+  size_t BufferSize() const;
+
+ private:
+  friend class MessageBuffer;
+
+  std::shared_ptr<message_details::BufferPool> pool_;
+};
+
 class MessageBuffer {
  public:
   static mcom::Result<MessageBuffer> Receive(const ReceiveRight &right,
                                              size_t size);
 
+  static mcom::Result<MessageBuffer> Receive(const ReceiveRight &right,
+                                             size_t size,
+                                             const MessageBufferPool &pool);
+
+  // Receives a message only if one is already queued on the port. Fails with
+  // MACH_RCV_TIMED_OUT when the port is empty.
+  static mcom::Result<MessageBuffer> TryReceive(const ReceiveRight &right,
+                                                size_t size,
+                                                const MessageBufferPool &pool);
+
   MessageBuffer(MessageBuffer &&) = default;
 
   MessageBuffer &operator=(MessageBuffer &&) = delete;
@@ -541,6 +579,10 @@ class MessageBuffer {
 
   mach_msg_id_t MessageId() const;
 
+  std::chrono::steady_clock::time_point ReceiveTime() const {
+    return receive_time_;
+  }
+
   mcom::AuditToken AuditToken() const;
 
   mcom::Optional<SendOnceRight> ExtractReplyPort();
@@ -556,15 +598,31 @@ class MessageBuffer {
   }
 
  private:
-  using Buffer = std::unique_ptr<void, void (*)(void *)>;
+  struct BufferDeleter {
+    std::shared_ptr<message_details::BufferPool> pool;
+
+    void operator()(void *buffer) const;
+  };
+
+  using Buffer = std::unique_ptr<void, BufferDeleter>;
 
   MessageBuffer(Buffer buffer);
 
+  static mcom::Result<MessageBuffer> ReceiveInto(
+      const ReceiveRight &right, Buffer buffer, size_t buffer_size,
+      mach_msg_option_t options = 0,
+      mach_msg_timeout_t timeout = MACH_MSG_TIMEOUT_NONE);
+
+  static mcom::Result<MessageBuffer> ReceiveImpl(
+      const ReceiveRight &right, size_t size, const MessageBufferPool &pool,
+      mach_msg_option_t options, mach_msg_timeout_t timeout);
+
   mach_msg_header_t &Header();
 
   const mach_msg_header_t &Header() const;
 
   Buffer buffer_;
+  std::chrono::steady_clock::time_point receive_time_;
 };
 
 template <bool Extra = false>
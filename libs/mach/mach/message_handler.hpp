@@ -22,6 +22,8 @@
 
 #include <cstdlib>
 #include <functional>
+#include <optional>
+#include <tuple>
 
 #include <mach/mach.h>
 
@@ -115,16 +117,24 @@ class MessageHandler {
         CreateHandler(msg_id, std::forward<Fn>(handler)));
   }
 
-  using HandlerInfo = std::pair<size_t, Handler>;
+  using HandlerInfo = std::tuple<mach_msg_id_t, size_t, Handler>;
 
   MessageHandler(size_t size, Handler handler)
       : size_{size}, handler_{std::move(handler)} {}
 
+  MessageHandler(mach_msg_id_t msg_id, size_t size, Handler handler)
+      : msg_id_{msg_id}, size_{size}, handler_{std::move(handler)} {}
+
   MessageHandler(MessageHandler &&other)
-      : size_{other.size_}, handler_{std::move(other.handler_)} {}
+      : msg_id_{other.msg_id_},
+        size_{other.size_},
+        handler_{std::move(other.handler_)} {}
 
   MessageHandler &operator=(MessageHandler &&) = delete;
 
+  // The message id the handler accepts, if known.
+  std::optional<mach_msg_id_t> MessageId() const { return msg_id_; }
+
   size_t MessageSize() const { return size_; }
 
   bool Handle(MessageBuffer &buffer) const { return handler_(buffer); }
@@ -183,7 +193,7 @@ class MessageHandler {
       return true;
     };
 
-    return {sizeof(Message<In...>), std::move(handler)};
+    return {msg_id, sizeof(Message<In...>), std::move(handler)};
   }
 
   template <class Fn, class... In, class... Args>
@@ -219,9 +229,10 @@ class MessageHandler {
       return true;
     };
 
-    return {sizeof(Message<In...>), std::move(handler)};
+    return {msg_id, sizeof(Message<In...>), std::move(handler)};
   }
 
+  const std::optional<mach_msg_id_t> msg_id_;
   const size_t size_;
   Handler handler_;
 };
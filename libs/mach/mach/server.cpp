@@ -22,6 +22,7 @@
 
 #include "server.hpp"
 
+#include <algorithm>
 #include <cstdio>
 
 namespace mach {
@@ -76,8 +77,24 @@ dispatch::Queue QueueForType(Server::QueueType type) {
       [](Server::GlobalQueue) { return dispatch::Queue{}; });
 }
 
+thread_local server_internal::DispatchContext *current_dispatch_context =
+    nullptr;
+
 }  // namespace
 
+namespace server_internal {
+
+DispatchContext *CurrentDispatchContext() { return current_dispatch_context; }
+
+DispatchScope::DispatchScope(DispatchContext &context)
+    : previous_{current_dispatch_context} {
+  current_dispatch_context = &context;
+}
+
+DispatchScope::~DispatchScope() { current_dispatch_context = previous_; }
+
+}  // namespace server_internal
+
 Server::Server(const ReceiveRight &port, QueueType queue)
     : port_{port},
       queue_{QueueForType(queue)},
@@ -97,6 +114,18 @@ void Server::AddHandler(MessageHandler &&handler) {
   });
 }
 
+void Server::SetMaxBatchSize(size_t count) {
+  max_batch_size_ = std::max<size_t>(count, 1);
+}
+
+void Server::EnableStatistics(bool enable) { statistics_enabled_ = enable; }
+
+ServerStatisticsSnapshot Server::Statistics() const {
+  return statistics_.Snapshot();
+}
+
+void Server::ResetStatistics() { statistics_.Reset(); }
+
 void Server::Resume() { source_.Resume(); }
 
 void Server::Suspend() { source_.Suspend(); }
@@ -125,37 +154,126 @@ void Server::HandleSourceEvent() const {
     }
   });
 
-  auto buffer = MessageBuffer::Receive(port_, max_message_size);
+  auto buffer = MessageBuffer::Receive(port_, max_message_size, buffer_pool_);
   if (!buffer) {
     return;
   }
 
+  const size_t max_batch_size = max_batch_size_;
+
+  if (max_batch_size == 1) {
+    if (UsesMainQueue()) {
+      HandleMessage(*buffer);
+    } else {
+      group_.Async(queue_, [this, buffer = std::move(*buffer)]() mutable {
+        HandleMessage(buffer);
+      });
+    }
+    return;
+  }
+
+  // Drain whatever is already queued on the port without blocking
+  std::vector<MessageBuffer> batch;
+  batch.push_back(std::move(*buffer));
+
+  while (batch.size() < max_batch_size) {
+    auto next =
+        MessageBuffer::TryReceive(port_, max_message_size, buffer_pool_);
+    if (!next) {
+      break;
+    }
+    batch.push_back(std::move(*next));
+  }
+
   if (UsesMainQueue()) {
-    HandleMessage(*buffer);
+    HandleMessages(batch);
   } else {
-    group_.Async(queue_, [this, buffer = std::move(*buffer)]() mutable {
-      HandleMessage(buffer);
+    group_.Async(queue_, [this, batch = std::move(batch)]() mutable {
+      HandleMessages(batch);
     });
   }
 }
 
 void Server::HandleMessage(MessageBuffer &buffer) const {
   const bool handled = AccessHandlers([&](const Handlers &handlers) {
-    bool handled = std::any_of(
+    return HandleMessage(handlers, buffer);
+  });
+
+  if (!handled) {
+    std::fprintf(stderr, "no handler for msg(%d)\n", buffer.MessageId());
+  }
+}
+
+void Server::HandleMessages(std::vector<MessageBuffer> &buffers) const {
+  AccessHandlers([&](const Handlers &handlers) {
+    for (auto &buffer : buffers) {
+      if (!HandleMessage(handlers, buffer)) {
+        std::fprintf(stderr, "no handler for msg(%d)\n", buffer.MessageId());
+      }
+    }
+  });
+}
+
+bool Server::HandleMessage(const Handlers &handlers,
+                           MessageBuffer &buffer) const {
+  if (statistics_enabled_) {
+    return HandleMessageWithStatistics(handlers, buffer);
+  }
+
+  bool handled =
+      std::any_of(handlers.general.begin(), handlers.general.end(),
+                  [&buffer](auto &handler) { return handler.Handle(buffer); });
+
+  if (!handled && buffer.MessageId() == MACH_NOTIFY_NO_SENDERS &&
+      handlers.no_senders) {
+    handled = handlers.no_senders->Handle(buffer);
+  }
+
+  return handled;
+}
+
+bool Server::HandleMessageWithStatistics(const Handlers &handlers,
+                                         MessageBuffer &buffer) const {
+  const mach_msg_id_t msg_id = buffer.MessageId();
+  statistics_.RecordReceived(msg_id);
+
+  // Handlers registered through AddHandler(msg_id, fn) on a concurrent server
+  // re-dispatch their body; they pick the context up and record the timing
+  // themselves once the body has run.
+  server_internal::DispatchContext context{&statistics_, msg_id,
+                                           buffer.ReceiveTime()};
+  const auto start = ServerStatistics::Clock::now();
+
+  bool handled;
+  {
+    server_internal::DispatchScope scope{context};
+    handled = std::any_of(
         handlers.general.begin(), handlers.general.end(),
         [&buffer](auto &handler) { return handler.Handle(buffer); });
 
-    if (!handled && buffer.MessageId() == MACH_NOTIFY_NO_SENDERS &&
-        handlers.no_senders) {
+    if (!handled && msg_id == MACH_NOTIFY_NO_SENDERS && handlers.no_senders) {
       handled = handlers.no_senders->Handle(buffer);
     }
-
-    return handled;
-  });
+  }
 
   if (!handled) {
-    std::fprintf(stderr, "no handler for msg(%d)\n", buffer.MessageId());
+    // A handler registered for this id refused the message, so it must have
+    // failed to decode.
+    const bool expected = std::any_of(
+        handlers.general.begin(), handlers.general.end(),
+        [msg_id](auto &handler) { return handler.MessageId() == msg_id; });
+
+    if (expected) {
+      statistics_.RecordDecodeFailure(msg_id);
+    } else {
+      statistics_.RecordNoHandler();
+    }
+  } else if (!context.deferred) {
+    statistics_.RecordHandled(msg_id, start - context.receive_time,
+                              ServerStatistics::Clock::now() - start);
   }
+
+  return handled;
 }
 
 }  // namespace mach
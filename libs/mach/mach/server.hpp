@@ -20,6 +20,7 @@
 // Created by Alexey Antipov on 13/02/2019.
 //
 
+#include <atomic>
 #include <optional>
 #include <variant>
 #include <vector>
@@ -32,6 +33,7 @@
 
 #include "mach/message_handler.hpp"
 #include "mach/server_internal.hpp"
+#include "mach/statistics.hpp"
 
 namespace mach {
 
@@ -61,6 +63,19 @@ class Server {
 
   void Cancel();
 
+  // Sets how many queued messages a single wakeup of the receive source may
+  // drain from the port. The drained messages are handled one after another
+  // by a single dispatch block. Defaults to 1.
+  void SetMaxBatchSize(size_t count);
+
+  // Per message id counters and latency histograms. Collection is off by
+  // default and costs nothing until enabled.
+  void EnableStatistics(bool enable);
+
+  ServerStatisticsSnapshot Statistics() const;
+
+  void ResetStatistics();
+
   const ReceiveRight &Port() const { return port_; }
 
   template <class Fn>
@@ -82,6 +97,13 @@ class Server {
 
   void HandleMessage(MessageBuffer &buffer) const;
 
+  void HandleMessages(std::vector<MessageBuffer> &buffers) const;
+
+  bool HandleMessage(const Handlers &handlers, MessageBuffer &buffer) const;
+
+  bool HandleMessageWithStatistics(const Handlers &handlers,
+                                   MessageBuffer &buffer) const;
+
   template <class Fn>
   auto AccessHandlers(Fn &&fn) -> decltype(fn(std::declval<Handlers &>()));
 
@@ -95,7 +117,11 @@ class Server {
   dispatch::MachReceiveSource source_;
   dispatch::Semaphore source_cancellation_semaphore_{0};
   dispatch::Group group_;
-  mcom::Sync<Handlers> handlers_;
+  mcom::Sync<Handlers> handlers_{mcom::LockName{"mach.Server.handlers"}};
+  MessageBufferPool buffer_pool_;
+  std::atomic<size_t> max_batch_size_{1};
+  std::atomic<bool> statistics_enabled_{false};
+  mutable ServerStatistics statistics_;
 };
 
 template <class Fn>
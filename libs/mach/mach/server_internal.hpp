@@ -19,16 +19,43 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
+#include <optional>
 #include <tuple>
 
 #include <mcom/dispatch.hpp>
 #include <mcom/types.hpp>
 
+#include "mach/statistics.hpp"
+
 namespace mach {
 
 namespace server_internal {
 
+// Describes the message being dispatched on the current thread while
+// statistics are enabled. Handlers that defer their work to another queue
+// mark the context so that timing is recorded when the work actually runs.
+struct DispatchContext {
+  ServerStatistics *statistics;
+  mach_msg_id_t msg_id;
+  std::chrono::steady_clock::time_point receive_time;
+  bool deferred = false;
+};
+
+DispatchContext *CurrentDispatchContext();
+
+class DispatchScope {
+ public:
+  explicit DispatchScope(DispatchContext &context);
+  ~DispatchScope();
+
+  DispatchScope(const DispatchScope &) = delete;
+
+ private:
+  DispatchContext *previous_;
+};
+
 template <class Fn, class... Args>
 struct AsyncHandler;
 
@@ -39,9 +66,25 @@ struct AsyncHandler<Fn, mcom::types<Args...>> {
   dispatch::Queue queue;
 
   void operator()(Args... args) const {
+    std::optional<DispatchContext> context;
+    if (auto current = CurrentDispatchContext()) {
+      current->deferred = true;
+      context = *current;
+    }
+
     std::tuple<Args...> args_tuple{std::move(args)...};
-    group.Async(queue, [this, args = std::move(args_tuple)]() mutable {
+    group.Async(queue, [this, context,
+                        args = std::move(args_tuple)]() mutable {
+      if (!context) {
+        std::apply(handler, std::move(args));
+        return;
+      }
+
+      const auto start = std::chrono::steady_clock::now();
       std::apply(handler, std::move(args));
+      context->statistics->RecordHandled(
+          context->msg_id, start - context->receive_time,
+          std::chrono::steady_clock::now() - start);
     });
   }
 };
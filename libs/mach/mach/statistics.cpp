@@ -0,0 +1,134 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "mach/statistics.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+
+namespace mach {
+
+namespace {
+
+using Microseconds = std::chrono::duration<double, std::micro>;
+
+size_t BucketIndex(LatencyHistogram::Duration duration) {
+  const auto us =
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  size_t index = 0;
+  for (auto value = static_cast<uint64_t>(std::max<int64_t>(us, 0)); value != 0;
+       value >>= 1) {
+    ++index;
+  }
+  return std::min(index, LatencyHistogram::kBucketCount - 1);
+}
+
+double ToMicroseconds(LatencyHistogram::Duration duration) {
+  return std::chrono::duration_cast<Microseconds>(duration).count();
+}
+
+}  // namespace
+
+void LatencyHistogram::Record(Duration duration) {
+  ++buckets_[BucketIndex(duration)];
+  ++count_;
+  total_ += duration;
+  max_ = std::max(max_, duration);
+}
+
+LatencyHistogram::Duration LatencyHistogram::Percentile(double fraction) const {
+  if (count_ == 0) {
+    return Duration{0};
+  }
+
+  const auto target = static_cast<uint64_t>(fraction * count_);
+  uint64_t seen = 0;
+
+  for (size_t index = 0; index < kBucketCount; ++index) {
+    seen += buckets_[index];
+    if (seen > target) {
+      const auto bound = std::chrono::microseconds{uint64_t{1} << index};
+      return std::min<Duration>(bound, max_);
+    }
+  }
+
+  return max_;
+}
+
+void ServerStatisticsSnapshot::Dump(std::FILE *file) const {
+  std::fprintf(file,
+               "%8s %10s %10s %8s %12s %12s %12s %12s %12s %12s\n", "msg",
+               "received", "handled", "decode", "wait p50us", "wait p99us",
+               "wait max", "run p50us", "run p99us", "run max");
+
+  for (auto &[msg_id, stats] : messages) {
+    std::fprintf(file,
+                 "%8d %10" PRIu64 " %10" PRIu64 " %8" PRIu64
+                 " %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+                 msg_id, stats.received, stats.handled, stats.decode_failures,
+                 ToMicroseconds(stats.queue_wait.Percentile(0.5)),
+                 ToMicroseconds(stats.queue_wait.Percentile(0.99)),
+                 ToMicroseconds(stats.queue_wait.Max()),
+                 ToMicroseconds(stats.handler_run.Percentile(0.5)),
+                 ToMicroseconds(stats.handler_run.Percentile(0.99)),
+                 ToMicroseconds(stats.handler_run.Max()));
+  }
+
+  std::fprintf(file, "unhandled: %" PRIu64 "\n", unhandled);
+}
+
+void ServerStatistics::RecordReceived(mach_msg_id_t msg_id) {
+  messages_.Use(msg_id, [&](auto &messages) { ++messages[msg_id].received; });
+}
+
+void ServerStatistics::RecordHandled(mach_msg_id_t msg_id,
+                                     Clock::duration queue_wait,
+                                     Clock::duration handler_run) {
+  messages_.Use(msg_id, [&](auto &messages) {
+    auto &stats = messages[msg_id];
+    ++stats.handled;
+    stats.queue_wait.Record(queue_wait);
+    stats.handler_run.Record(handler_run);
+  });
+}
+
+void ServerStatistics::RecordDecodeFailure(mach_msg_id_t msg_id) {
+  messages_.Use(msg_id,
+                [&](auto &messages) { ++messages[msg_id].decode_failures; });
+}
+
+void ServerStatistics::RecordNoHandler() {
+  unhandled_.fetch_add(1, std::memory_order_relaxed);
+}
+
+ServerStatisticsSnapshot ServerStatistics::Snapshot() const {
+  ServerStatisticsSnapshot snapshot;
+  messages_.ForEachShard([&](const auto &messages) {
+    snapshot.messages.insert(messages.begin(), messages.end());
+  });
+  snapshot.unhandled = unhandled_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+void ServerStatistics::Reset() {
+  messages_.ForEachShard([](auto &messages) { messages.clear(); });
+  unhandled_.store(0, std::memory_order_relaxed);
+}
+
+}  // namespace mach
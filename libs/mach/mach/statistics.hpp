@@ -0,0 +1,108 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+
+#include <mach/mach.h>
+
+#include <mcom/sync.hpp>
+
+namespace mach {
+
+// Power-of-two histogram of durations. Bucket 0 counts samples shorter than
+// one microsecond, bucket i counts samples in [2^(i-1), 2^i) microseconds and
+// the last bucket collects everything longer.
+class LatencyHistogram {
+ public:
+  using Duration = std::chrono::steady_clock::duration;
+
+  static constexpr size_t kBucketCount = 28;
+
+  void Record(Duration duration);
+
+  uint64_t Count() const { return count_; }
+
+  Duration Total() const { return total_; }
+
+  Duration Max() const { return max_; }
+
+  uint64_t Bucket(size_t index) const { return buckets_[index]; }
+
+  // Upper bound of the bucket holding the given fraction of samples.
+  Duration Percentile(double fraction) const;
+
+ private:
+  std::array<uint64_t, kBucketCount> buckets_{};
+  uint64_t count_ = 0;
+  Duration total_{0};
+  Duration max_{0};
+};
+
+struct MessageStatistics {
+  uint64_t received = 0;
+  uint64_t handled = 0;
+  uint64_t decode_failures = 0;
+
+  // Time from receiving the message off the port until its handler starts.
+  LatencyHistogram queue_wait;
+
+  // Time spent running the handler.
+  LatencyHistogram handler_run;
+};
+
+struct ServerStatisticsSnapshot {
+  std::map<mach_msg_id_t, MessageStatistics> messages;
+
+  // Messages no registered handler was interested in.
+  uint64_t unhandled = 0;
+
+  void Dump(std::FILE *file) const;
+};
+
+class ServerStatistics {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  void RecordReceived(mach_msg_id_t msg_id);
+
+  void RecordHandled(mach_msg_id_t msg_id, Clock::duration queue_wait,
+                     Clock::duration handler_run);
+
+  void RecordDecodeFailure(mach_msg_id_t msg_id);
+
+  void RecordNoHandler();
+
+  ServerStatisticsSnapshot Snapshot() const;
+
+  void Reset();
+
+ private:
+  // Handlers of different messages record into different shards
+  mcom::ShardedSync<mach_msg_id_t, MessageStatistics> messages_;
+  std::atomic<uint64_t> unhandled_{0};
+};
+
+}  // namespace mach
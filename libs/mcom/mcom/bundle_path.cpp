@@ -0,0 +1,98 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "bundle_path.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+
+#include <mcom/file_path.hpp>
+
+namespace mcom {
+
+namespace {
+
+constexpr std::array<std::string_view, 4> kBundleExtensions{
+    "app", "xpc", "appex", "framework"};
+
+bool EqualsIgnoringCase(std::string_view lhs, std::string_view rhs) {
+  return lhs.size() == rhs.size() &&
+         std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char l, char r) {
+           return std::tolower(static_cast<unsigned char>(l)) ==
+                  std::tolower(static_cast<unsigned char>(r));
+         });
+}
+
+// Extension of a path component, empty if there is none. Version-like
+// suffixes such as "3.9.1" don't count, a bundle extension has a letter.
+std::string_view Extension(std::string_view component) {
+  const auto dot = component.rfind('.');
+  if (dot == std::string_view::npos || dot == 0) {
+    return {};
+  }
+
+  const auto extension = component.substr(dot + 1);
+  const bool has_letter =
+      std::any_of(extension.begin(), extension.end(), [](char c) {
+        return std::isalpha(static_cast<unsigned char>(c));
+      });
+  return has_letter ? extension : std::string_view{};
+}
+
+}  // namespace
+
+LexicalBundlePath ResolveBundlePathLexically(std::string_view executable_path) {
+  bool ambiguous = false;
+
+  // The last component is the executable itself and is never a bundle.
+  if (executable_path.find('/') == std::string_view::npos) {
+    return {LexicalBundlePath::Kind::Unknown, {}};
+  }
+
+  const auto directory = FilePathView{executable_path}.Dirname();
+  for (std::string_view component : directory.Components()) {
+    const auto extension = Extension(component);
+    if (!extension.empty()) {
+      const bool known = std::any_of(
+          kBundleExtensions.begin(), kBundleExtensions.end(),
+          [&](auto bundle_extension) {
+            return EqualsIgnoringCase(extension, bundle_extension);
+          });
+
+      if (known) {
+        // Outer components with unknown extensions may be bundles as well
+        if (ambiguous) {
+          return {LexicalBundlePath::Kind::Unknown, {}};
+        }
+        const auto end = component.data() + component.size();
+        return {LexicalBundlePath::Kind::Bundle,
+                executable_path.substr(0, end - executable_path.data())};
+      }
+
+      ambiguous = true;
+    }
+  }
+
+  return {ambiguous ? LexicalBundlePath::Kind::Unknown
+                    : LexicalBundlePath::Kind::NotBundle,
+          {}};
+}
+
+}  // namespace mcom
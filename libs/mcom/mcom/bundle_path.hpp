@@ -0,0 +1,46 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string_view>
+
+namespace mcom {
+
+// Lexical bundle detection for executable paths. Bundles are recognized by
+// the extension of a directory component, so most paths can be classified
+// without touching the file system.
+struct LexicalBundlePath {
+  enum class Kind {
+    // `path` is the root of the outermost bundle containing the executable.
+    Bundle,
+    // No directory component can be a bundle.
+    NotBundle,
+    // Some directory component carries an extension we don't know about,
+    // the file system has to be asked.
+    Unknown,
+  };
+
+  Kind kind;
+  std::string_view path;
+};
+
+LexicalBundlePath ResolveBundlePathLexically(std::string_view executable_path);
+
+}  // namespace mcom
@@ -0,0 +1,75 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "mcom/canonical_path_cache.hpp"
+
+#include <algorithm>
+#include <optional>
+
+namespace mcom {
+
+CanonicalPathCache::CanonicalPathCache(size_t capacity)
+    : capacity_{std::max<size_t>(capacity, 1)},
+      entries_{LockName{"mcom.CanonicalPathCache"}} {}
+
+FilePath CanonicalPathCache::Canonical(FilePathView path) {
+  std::string key{path.String()};
+
+  auto cached = entries_.Use([&](Entries &entries) -> std::optional<FilePath> {
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+      return it->second;
+    }
+    return std::nullopt;
+  });
+  if (cached) {
+    return std::move(*cached);
+  }
+
+  // Resolve without holding the lock, it hits the file system. The raw path
+  // goes to realpath, since ".." must apply to where a link points.
+  auto resolved = FilePath{key}.Canonical();
+  if (!resolved) {
+    return FilePath{NormalizePath(key)};
+  }
+
+  entries_.Use([&](Entries &entries) {
+    if (entries.size() >= capacity_) {
+      entries.clear();
+    }
+    entries.emplace(std::move(key), *resolved);
+  });
+
+  return *std::move(resolved);
+}
+
+void CanonicalPathCache::Invalidate(FilePathView path) {
+  const std::string key{path.String()};
+  entries_.Use([&](Entries &entries) { entries.erase(key); });
+}
+
+void CanonicalPathCache::Clear() {
+  entries_.Use([](Entries &entries) { entries.clear(); });
+}
+
+size_t CanonicalPathCache::Size() const {
+  return entries_.Use([](auto &entries) { return entries.size(); });
+}
+
+}  // namespace mcom
@@ -0,0 +1,58 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include <mcom/file_path.hpp>
+#include <mcom/sync.hpp>
+
+namespace mcom {
+
+// Caches FilePath::Canonical() results. Paths that can't be resolved, e.g.
+// because they don't exist yet, are normalized lexically and not cached. The
+// whole cache is dropped when it overflows; links rarely change, but
+// Invalidate() or Clear() can be called when they may have.
+class CanonicalPathCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 1024;
+
+  explicit CanonicalPathCache(size_t capacity = kDefaultCapacity);
+
+  CanonicalPathCache &operator=(CanonicalPathCache &&) = delete;
+
+  FilePath Canonical(FilePathView path);
+
+  // Drops the result for exactly this path, as it was passed to Canonical()
+  void Invalidate(FilePathView path);
+
+  void Clear();
+
+  size_t Size() const;
+
+ private:
+  using Entries = std::unordered_map<std::string, FilePath>;
+
+  const size_t capacity_;
+  Sync<Entries> entries_;
+};
+
+}  // namespace mcom
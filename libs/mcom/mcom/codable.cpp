@@ -0,0 +1,40 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "codable.hpp"
+
+#include "file.hpp"
+
+namespace mcom {
+
+std::error_code BufferSink::Write(const uint8_t *bytes, size_t size) {
+  if (size > size_ - written_) {
+    return std::make_error_code(std::errc::no_buffer_space);
+  }
+
+  std::memcpy(buffer_ + written_, bytes, size);
+  written_ += size;
+  return {};
+}
+
+std::error_code FileSink::Write(const uint8_t *bytes, size_t size) {
+  return file_.Write(bytes, size);
+}
+
+}  // namespace mcom
@@ -19,7 +19,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <vector>
 
 #include <mcom/optional.hpp>
@@ -36,24 +40,119 @@ struct is_codable : std::false_type {};
 template <class T>
 static constexpr bool is_codable_v = is_codable<T>::value;
 
+// Non-owning view of bytes: a vector, a mapped file, a message region.
+class ByteSpan {
+ public:
+  constexpr ByteSpan() noexcept : data_{nullptr}, size_{0} {}
+
+  constexpr ByteSpan(const uint8_t *data, size_t size) noexcept
+      : data_{data}, size_{size} {}
+
+  ByteSpan(const std::vector<uint8_t> &bytes) noexcept
+      : data_{bytes.data()}, size_{bytes.size()} {}
+
+  constexpr const uint8_t *Data() const noexcept { return data_; }
+  constexpr size_t Size() const noexcept { return size_; }
+
+ private:
+  const uint8_t *data_;
+  size_t size_;
+};
+
+class File;
+
+// Where an Encoder puts its bytes.
+class EncoderSink {
+ public:
+  virtual ~EncoderSink() = default;
+
+  virtual std::error_code Write(const uint8_t *bytes, size_t size) = 0;
+};
+
+// Appends to a vector that grows as needed.
+class VectorSink : public EncoderSink {
+ public:
+  std::error_code Write(const uint8_t *bytes, size_t size) override {
+    bytes_.insert(bytes_.end(), bytes, bytes + size);
+    return {};
+  }
+
+  const std::vector<uint8_t> &Bytes() const { return bytes_; }
+
+  std::vector<uint8_t> TakeBytes() { return std::move(bytes_); }
+
+ private:
+  std::vector<uint8_t> bytes_;
+};
+
+// Fills memory the caller owns, e.g. a mapped file. Fails with
+// no_buffer_space when the payload doesn't fit.
+class BufferSink : public EncoderSink {
+ public:
+  BufferSink(uint8_t *buffer, size_t size) : buffer_{buffer}, size_{size} {}
+
+  std::error_code Write(const uint8_t *bytes, size_t size) override;
+
+  size_t Written() const { return written_; }
+
+ private:
+  uint8_t *buffer_;
+  size_t size_;
+  size_t written_ = 0;
+};
+
+// Writes to a file; the encoder's staging buffer sets the chunk size.
+class FileSink : public EncoderSink {
+ public:
+  explicit FileSink(File &file) : file_{file} {}
+
+  std::error_code Write(const uint8_t *bytes, size_t size) override;
+
+ private:
+  File &file_;
+};
+
+// Encodes values into a sink. Small values are staged in a buffer of
+// bounded size and handed to the sink in chunks; values larger than the
+// buffer go to the sink directly. The first error the sink reports sticks,
+// later values are dropped.
 class Encoder {
  public:
-  Encoder() {}
+  static constexpr size_t kDefaultBufferSize = 0x10000;
+
+  // Encodes into a vector of its own, see Bytes().
+  Encoder() : sink_{&own_sink_} {}
+
+  explicit Encoder(EncoderSink &sink, size_t buffer_size = kDefaultBufferSize)
+      : sink_{&sink} {
+    buffer_.reserve(buffer_size);
+  }
+
+  Encoder(const Encoder &) = delete;
 
-  const std::vector<uint8_t> &Bytes() { return bytes_; }
+  ~Encoder() { Flush(); }
+
+  // Only for an encoder constructed without a sink.
+  const std::vector<uint8_t> &Bytes() {
+    Flush();
+    return own_sink_.Bytes();
+  }
 
   template <class T>
   auto EncodePod(const T &value) -> std::enable_if_t<std::is_pod<T>::value> {
-    auto begin = reinterpret_cast<const uint8_t *>(std::addressof(value));
-    bytes_.insert(bytes_.end(), begin, begin + sizeof(T));
+    AddBytes(reinterpret_cast<const uint8_t *>(std::addressof(value)),
+             sizeof(T));
   }
 
-  void EncodeString(const char *str);
+  void EncodeString(const char *str) { EncodeString(std::string_view{str}); }
 
-  void EncodeString(const std::string &str) {
+  void EncodeString(std::string_view str) {
     EncodePod<size_t>(str.size());
-    auto begin = reinterpret_cast<const uint8_t *>(str.data());
-    bytes_.insert(bytes_.end(), begin, begin + str.size());
+    AddBytes(reinterpret_cast<const uint8_t *>(str.data()), str.size());
+  }
+
+  void EncodeString(const std::string &str) {
+    EncodeString(std::string_view{str});
   }
 
   template <class T>
@@ -61,37 +160,109 @@ class Encoder {
     codable<T>{}.encode(value, *this);
   }
 
+  void AddBytes(const uint8_t *bytes, size_t size) {
+    if (buffer_.capacity() - buffer_.size() >= size) {
+      buffer_.insert(buffer_.end(), bytes, bytes + size);
+      return;
+    }
+
+    Flush();
+    if (size < buffer_.capacity()) {
+      buffer_.insert(buffer_.end(), bytes, bytes + size);
+    } else if (!error_) {
+      error_ = sink_->Write(bytes, size);
+    }
+  }
+
+  // Hands the staged bytes to the sink. Returns the first error so far.
+  std::error_code Flush() {
+    if (!buffer_.empty()) {
+      if (!error_) {
+        error_ = sink_->Write(buffer_.data(), buffer_.size());
+      }
+      buffer_.clear();
+    }
+    return error_;
+  }
+
+  std::error_code Error() const { return error_; }
+
  private:
-  std::vector<uint8_t> bytes_;
+  VectorSink own_sink_;
+  EncoderSink *sink_;
+  std::vector<uint8_t> buffer_;
+  std::error_code error_;
 };
 
+// Reads values in the order they were encoded. The decoder doesn't copy its
+// input: the bytes, and the string views decoded from them, must outlive
+// it unless the decoder was given a vector to own.
+//
+// Reading past the end marks the decoder as failed; from then on every
+// value decodes as zero or empty, and callers check Failed() once at the
+// end.
 class Decoder {
  public:
-  Decoder(const std::vector<uint8_t> &bytes)
-      : bytes_{bytes}, ptr_{bytes_.data()} {}
+  Decoder(ByteSpan bytes) noexcept
+      : ptr_{bytes.Data()}, end_{bytes.Data() + bytes.Size()} {}
+
+  Decoder(const std::vector<uint8_t> &bytes) noexcept
+      : Decoder{ByteSpan{bytes}} {}
+
+  Decoder(std::vector<uint8_t> &&bytes) noexcept
+      : owned_{std::move(bytes)},
+        ptr_{owned_.data()},
+        end_{owned_.data() + owned_.size()} {}
+
+  Decoder(const Decoder &) = delete;
 
   template <class T>
   auto DecodePod() -> std::enable_if_t<std::is_pod<T>::value, T> {
-    auto value_ptr = reinterpret_cast<const T *>(ptr_);
-    ptr_ += sizeof(T);
-    return *value_ptr;
+    T value{};
+    if (auto bytes = Take(sizeof(T))) {
+      std::memcpy(std::addressof(value), bytes, sizeof(T));
+    }
+    return value;
   }
 
-  std::string DecodeString() {
+  std::string_view DecodeStringView() {
     const auto size = DecodePod<size_t>();
-    auto begin = reinterpret_cast<const char *>(ptr_);
-    ptr_ += size;
-    return std::string{begin, begin + size};
+    auto begin = reinterpret_cast<const char *>(Take(size));
+    return begin ? std::string_view{begin, size} : std::string_view{};
   }
 
+  std::string DecodeString() { return std::string{DecodeStringView()}; }
+
   template <class T>
   auto Decode() -> std::enable_if_t<is_codable_v<T>, T> {
     return codable<T>{}.decode(*this);
   }
 
+  // A count read from the input is only trusted as far as the remaining
+  // bytes could hold that many elements of at least min_size bytes each.
+  size_t ReserveCount(size_t count, size_t min_size) const noexcept {
+    return std::min(count, Remaining() / std::max<size_t>(min_size, 1));
+  }
+
+  size_t Remaining() const noexcept { return size_t(end_ - ptr_); }
+
+  bool Failed() const noexcept { return failed_; }
+
  private:
-  const std::vector<uint8_t> bytes_;
+  const uint8_t *Take(size_t size) noexcept {
+    if (failed_ || size > Remaining()) {
+      failed_ = true;
+      return nullptr;
+    }
+    auto bytes = ptr_;
+    ptr_ += size;
+    return bytes;
+  }
+
+  std::vector<uint8_t> owned_;
   const uint8_t *ptr_;
+  const uint8_t *end_;
+  bool failed_ = false;
 };
 
 template <class T>
@@ -120,7 +291,9 @@ struct vector_codable_impl<T, void_t<std::enable_if_t<is_codable_v<T>>>> {
   std::vector<T> decode(Decoder &decoder) {
     const std::size_t size = decoder.DecodePod<size_t>();
     std::vector<T> vector;
-    for (size_t i = 0; i < size; ++i) {
+    vector.reserve(
+        decoder.ReserveCount(size, std::is_pod<T>::value ? sizeof(T) : 1));
+    for (size_t i = 0; i < size && !decoder.Failed(); ++i) {
       vector.emplace_back(decoder.Decode<T>());
     }
     return vector;
@@ -141,4 +314,16 @@ struct codable<std::string> {
   std::string decode(Decoder &decoder) { return decoder.DecodeString(); }
 };
 
+// Decodes as a view into the decoder's input.
+template <>
+struct codable<std::string_view> {
+  void encode(std::string_view str, Encoder &encoder) {
+    encoder.EncodeString(str);
+  }
+
+  std::string_view decode(Decoder &decoder) {
+    return decoder.DecodeStringView();
+  }
+};
+
 }  // namespace mcom
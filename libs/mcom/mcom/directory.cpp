@@ -29,12 +29,80 @@
 
 namespace mcom {
 
-Directory::Directory(int fd) : fd_(fd), dir_(nullptr) {}
+namespace {
+
+File::Type EntryType(unsigned char d_type) noexcept {
+  switch (d_type) {
+    case DT_REG:
+      return File::Type::Regular;
+    case DT_DIR:
+      return File::Type::Directory;
+    default:
+      return File::Type::Unknown;
+  }
+}
+
+bool IsDotOrDotDot(const char *name) noexcept {
+  return name[0] == '.' &&
+         (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+}  // namespace
+
+DirectoryEnumerator::DirectoryEnumerator(int fd) noexcept : fd_{fd} {
+  dir_ = ::fdopendir(fd_);
+  if (dir_ == nullptr) {
+    error_ = std::make_error_code(std::errc(errno));
+  }
+}
+
+DirectoryEnumerator::DirectoryEnumerator(DirectoryEnumerator &&other) noexcept
+    : fd_{other.fd_},
+      dir_{other.dir_},
+      entry_{other.entry_},
+      error_{other.error_} {
+  other.fd_ = -1;
+  other.dir_ = nullptr;
+}
+
+DirectoryEnumerator::~DirectoryEnumerator() {
+  if (dir_ != nullptr) {
+    ::closedir(dir_);
+    return;
+  }
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+}
+
+bool DirectoryEnumerator::Next() noexcept {
+  if (dir_ == nullptr) {
+    return false;
+  }
+
+  while (true) {
+    errno = 0;
+    const struct dirent *ent = ::readdir(dir_);
+    if (ent == nullptr) {
+      if (errno != 0) {
+        error_ = std::make_error_code(std::errc(errno));
+      }
+      return false;
+    }
+
+    if (IsDotOrDotDot(ent->d_name)) {
+      continue;
+    }
+
+    entry_ = {{ent->d_name, ent->d_namlen}, EntryType(ent->d_type)};
+    return true;
+  }
+}
+
+Directory::Directory(int fd) : fd_(fd) {}
 
-Directory::Directory(Directory &&dir)
-    : fd_(dir.fd_), dir_(dir.dir_), remove_(dir.remove_) {
+Directory::Directory(Directory &&dir) : fd_(dir.fd_), remove_(dir.remove_) {
   dir.fd_ = -1;
-  dir.dir_ = nullptr;
 }
 
 Directory::~Directory() { Close(); }
@@ -168,39 +236,33 @@ std::error_code Directory::RemoveSubdirectory(const FilePath &path) noexcept {
 }
 
 Result<std::vector<FilePath>> Directory::Entries() noexcept {
-  if (dir_) {
-    ::rewinddir(dir_);
-  } else {
-    dir_ = ::fdopendir(fd_);
-    if (dir_ == nullptr) {
-      return std::make_error_code(std::errc(errno));
-    }
+  auto enumerator = Enumerate();
+  if (!enumerator) {
+    return enumerator.Code();
   }
 
-  struct dirent ent;
-  struct dirent *entp;
   std::vector<FilePath> es;
 
-  while (true) {
-    if (0 != ::readdir_r(dir_, &ent, &entp)) {
-      return std::make_error_code(std::errc(errno));
-    }
+  for (const DirectoryEntry &entry : *enumerator) {
+    es.emplace_back(std::string{entry.name});
+  }
 
-    if (entp != &ent) {
-      break;
-    }
+  if (enumerator->Error()) {
+    return enumerator->Error();
+  }
 
-    // Skip '.' and '..' entries
-    if (ent.d_name[0] == '.' &&
-        (ent.d_name[1] == '\0' ||
-         (ent.d_name[1] == '.' && ent.d_name[2] == '\0'))) {
-      continue;
-    }
+  return es;
+}
 
-    es.emplace_back(std::string(ent.d_name, ent.d_namlen));
+Result<DirectoryEnumerator> Directory::Enumerate() noexcept {
+  // A separate descriptor has its own read offset, so enumerations don't
+  // interfere with each other
+  int fd = ::openat(fd_, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return std::make_error_code(std::errc(errno));
   }
 
-  return es;
+  return DirectoryEnumerator{fd};
 }
 
 void Directory::SetRemoveWhenClosed(bool remove) noexcept { remove_ = remove; }
@@ -246,12 +308,7 @@ std::error_code Directory::Close() noexcept {
 
   int err = 0;
 
-  if (dir_ != nullptr) {
-    if (0 != ::closedir(dir_)) {
-      err = errno;
-    }
-    dir_ = nullptr;
-  } else if (fd_ != -1) {
+  if (fd_ != -1) {
     if (0 != ::close(fd_)) {
       err = errno;
     }
@@ -19,6 +19,9 @@
 
 #pragma once
 
+#include <functional>
+#include <memory>
+#include <string_view>
 #include <system_error>
 #include <vector>
 
@@ -28,8 +31,91 @@
 
 namespace mcom {
 
+struct DirectoryEntry {
+  // Points into the enumerator's buffer and is followed by a NUL; valid
+  // until the next entry is read
+  std::string_view name;
+  // Unknown when the file system doesn't report the type or the entry is
+  // neither a regular file nor a directory; GetAttributes tells for sure.
+  File::Type type;
+};
+
+// Reads entries lazily from its own descriptor of the directory; readdir
+// fetches them from the kernel in batches. Iteration stops at the end of
+// the directory or on the first error, which Error() then reports. '.' and
+// '..' are skipped.
+class DirectoryEnumerator {
+ public:
+  class Iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = DirectoryEntry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const DirectoryEntry *;
+    using reference = const DirectoryEntry &;
+
+    reference operator*() const noexcept { return enumerator_->entry_; }
+    pointer operator->() const noexcept { return &enumerator_->entry_; }
+
+    Iterator &operator++() noexcept {
+      if (!enumerator_->Next()) {
+        enumerator_ = nullptr;
+      }
+      return *this;
+    }
+
+    bool operator==(const Iterator &other) const noexcept {
+      return enumerator_ == other.enumerator_;
+    }
+    bool operator!=(const Iterator &other) const noexcept {
+      return enumerator_ != other.enumerator_;
+    }
+
+   private:
+    friend class DirectoryEnumerator;
+
+    explicit Iterator(DirectoryEnumerator *enumerator) noexcept
+        : enumerator_{enumerator} {}
+
+    DirectoryEnumerator *enumerator_;
+  };
+
+  DirectoryEnumerator(const DirectoryEnumerator &) = delete;
+  DirectoryEnumerator(DirectoryEnumerator &&) noexcept;
+  ~DirectoryEnumerator();
+
+  // Reads the next entry; false at the end of the directory or on error
+  bool Next() noexcept;
+
+  const DirectoryEntry &Entry() const noexcept { return entry_; }
+
+  std::error_code Error() const noexcept { return error_; }
+
+  Iterator begin() noexcept { return Iterator{Next() ? this : nullptr}; }
+  Iterator end() noexcept { return Iterator{nullptr}; }
+
+ private:
+  friend class Directory;
+
+  explicit DirectoryEnumerator(int fd) noexcept;
+
+  int fd_;
+  DIR *dir_ = nullptr;
+  DirectoryEntry entry_{{}, File::Type::Unknown};
+  std::error_code error_;
+};
+
 class Directory {
  public:
+  // Totals of a tree operation so far
+  struct TreeProgress {
+    uint64_t entries;
+    uint64_t bytes;
+  };
+
+  // Called from the worker threads, possibly concurrently
+  using TreeProgressHandler = std::function<void(const TreeProgress &)>;
+
   Directory(Directory &&);
   ~Directory();
 
@@ -48,8 +134,24 @@ class Directory {
 
   static std::error_code Remove(const FilePath &path) noexcept;
 
+  // Removes on the calling thread with removefile; Close() uses it for
+  // directories removed when closed. See RemoveTree for large trees.
   static std::error_code RemoveRecursive(const FilePath &path) noexcept;
 
+  // Walk the tree relative to directory descriptors, processing
+  // subdirectories in parallel on a few jobs on the global dispatch queue,
+  // and block the caller until done. Symbolic links are never followed.
+  // After the first error no new work is started and that error is returned.
+  static std::error_code RemoveTree(
+      const FilePath &path,
+      const TreeProgressHandler &progress = {}) noexcept;
+
+  // Copies directories, regular files and symbolic links with their
+  // permissions; other kinds of files are skipped. `to` must not exist.
+  static std::error_code CopyTree(
+      const FilePath &from, const FilePath &to,
+      const TreeProgressHandler &progress = {}) noexcept;
+
   Result<File> OpenEntry(const FilePath &path, File::Flags flags) noexcept;
 
   Result<Directory> OpenSubdirectory(const FilePath &path) noexcept;
@@ -58,6 +160,10 @@ class Directory {
 
   Result<std::vector<FilePath>> Entries() noexcept;
 
+  // Lazily enumerates the entries; cheaper than Entries() for large
+  // directories or when the scan can stop early.
+  Result<DirectoryEnumerator> Enumerate() noexcept;
+
   bool WillRemoveWhenClosed() const noexcept;
   void SetRemoveWhenClosed(bool remove) noexcept;
 
@@ -78,10 +184,11 @@ class Directory {
   std::error_code Close() noexcept;
 
  private:
+  struct TreeWalk;
+
   Directory(int fd);
 
   int fd_;
-  DIR *dir_;
   bool remove_ = false;
 };
 
@@ -0,0 +1,456 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "directory.hpp"
+
+#include <fcntl.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <mcom/dispatch.hpp>
+#include <mcom/sync.hpp>
+
+namespace mcom {
+
+namespace {
+
+constexpr int kDirectoryFlags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+
+// Directories are processed by at most this many jobs at a time, so that a
+// wide tree neither ties up the global queue nor runs out of descriptors
+constexpr int kMaxWorkers = 8;
+
+std::error_code LastError() { return std::make_error_code(std::errc(errno)); }
+
+// d_type is a hint only; file systems may not fill it in
+mode_t EntryFormat(int dir_fd, const DirectoryEntry &entry) {
+  switch (entry.type) {
+    case File::Type::Regular:
+      return S_IFREG;
+    case File::Type::Directory:
+      return S_IFDIR;
+    case File::Type::Unknown:
+      break;
+  }
+
+  struct stat info;
+  if (0 != ::fstatat(dir_fd, entry.name.data(), &info, AT_SYMLINK_NOFOLLOW)) {
+    return 0;
+  }
+  return info.st_mode & S_IFMT;
+}
+
+}  // namespace
+
+struct Directory::TreeWalk {
+  // A directory is done once its own entries and all of its subdirectories
+  // are; only then can it be removed or get its final permissions. Its
+  // source is needed until its subdirectories have opened theirs, and when
+  // removing, until they are removed.
+  struct Node {
+    std::shared_ptr<Node> parent;
+    std::string name;
+    std::optional<Directory> source;
+    std::optional<Directory> target;
+    mode_t mode = 0;
+    std::atomic<int> pending{1};
+    std::atomic<int> source_users{1};
+  };
+
+  // An entry that outlives the enumerator's buffer
+  struct Entry {
+    std::string name;
+    File::Type type;
+  };
+
+  using Visit = void (TreeWalk::*)(const std::shared_ptr<Node> &);
+
+  struct Work {
+    // Taken from the back: depth first, so that few directories are open
+    std::vector<std::shared_ptr<Node>> nodes;
+    int workers = 0;
+  };
+
+  TreeWalk(const TreeProgressHandler &progress, Visit visit)
+      : progress_{progress}, visit_{visit} {}
+
+  static int SourceParent(const Node &node) {
+    return node.parent ? node.parent->source->fd_ : AT_FDCWD;
+  }
+
+  void Fail(std::error_code error) {
+    error_.Use([&](std::error_code &first) {
+      if (!first) {
+        first = error;
+      }
+    });
+    failed_.store(true, std::memory_order_relaxed);
+  }
+
+  bool Failed() const { return failed_.load(std::memory_order_relaxed); }
+
+  void Count(uint64_t bytes) {
+    const uint64_t entries = entries_.fetch_add(1) + 1;
+    const uint64_t total_bytes = bytes_.fetch_add(bytes) + bytes;
+    if (progress_) {
+      progress_({entries, total_bytes});
+    }
+  }
+
+  void Spawn(const std::shared_ptr<Node> &parent, std::string_view name) {
+    auto node = std::make_shared<Node>();
+    node->parent = parent;
+    node->name = std::string{name};
+    parent->pending.fetch_add(1);
+    parent->source_users.fetch_add(1);
+
+    const bool start_worker = work_.Use([&](Work &work) {
+      work.nodes.push_back(std::move(node));
+      if (work.workers == kMaxWorkers) {
+        return false;
+      }
+      ++work.workers;
+      return true;
+    });
+
+    if (start_worker) {
+      group_.Async(queue_, [this] { RunWorker(); });
+    }
+  }
+
+  void RunWorker() {
+    while (true) {
+      auto node = work_.Use([](Work &work) -> std::shared_ptr<Node> {
+        if (work.nodes.empty()) {
+          --work.workers;
+          return nullptr;
+        }
+        auto node = std::move(work.nodes.back());
+        work.nodes.pop_back();
+        return node;
+      });
+      if (!node) {
+        return;
+      }
+
+      (this->*visit_)(node);
+    }
+  }
+
+  // Called once the node's own entries are enumerated and by each of its
+  // subdirectories once they have opened their source.
+  static void ReleaseSource(Node &node) {
+    if (node.source_users.fetch_sub(1) == 1) {
+      node.source.reset();
+    }
+  }
+
+  std::error_code Wait() {
+    group_.Wait(dispatch::Time::kForever);
+    return error_.Use([](std::error_code &error) { return error; });
+  }
+
+  // Removal
+
+  void RemoveDirectory(const std::shared_ptr<Node> &node) {
+    int fd = ::openat(SourceParent(*node), node->name.c_str(), kDirectoryFlags);
+    if (fd == -1) {
+      Fail(LastError());
+    } else {
+      node->source.emplace(Directory{fd});
+      RemoveEntries(node);
+    }
+    FinishRemoval(node);
+  }
+
+  void RemoveEntries(const std::shared_ptr<Node> &node) {
+    const int fd = node->source->fd_;
+    auto entries = node->source->Enumerate();
+    if (!entries) {
+      Fail(entries.Code());
+      return;
+    }
+
+    // Unlinking while enumerating shifts the directory offsets under the
+    // enumerator and entries get skipped, so list everything first
+    std::vector<Entry> listed;
+    for (const DirectoryEntry &entry : *entries) {
+      listed.push_back({std::string{entry.name}, entry.type});
+    }
+    if (entries->Error()) {
+      Fail(entries->Error());
+      return;
+    }
+
+    for (const Entry &entry : listed) {
+      if (Failed()) {
+        return;
+      }
+
+      if (entry.type != File::Type::Directory) {
+        if (0 == ::unlinkat(fd, entry.name.c_str(), 0)) {
+          Count(0);
+          continue;
+        }
+        // Directories whose type wasn't reported end up here
+        const int error = errno;
+        if ((error != EISDIR && error != EPERM) ||
+            EntryFormat(fd, {entry.name, entry.type}) != S_IFDIR) {
+          Fail(std::make_error_code(std::errc(error)));
+          return;
+        }
+      }
+
+      Spawn(node, entry.name);
+    }
+  }
+
+  void FinishRemoval(const std::shared_ptr<Node> &node) {
+    if (node->pending.fetch_sub(1) != 1) {
+      return;
+    }
+
+    node->source.reset();
+
+    if (!Failed()) {
+      if (0 == ::unlinkat(SourceParent(*node), node->name.c_str(),
+                          AT_REMOVEDIR)) {
+        Count(0);
+      } else {
+        Fail(LastError());
+      }
+    }
+
+    if (node->parent) {
+      FinishRemoval(node->parent);
+    }
+  }
+
+  // Copying
+
+  void CopyDirectory(const std::shared_ptr<Node> &node) {
+    const bool opened = OpenCopyDirectories(*node);
+    if (node->parent) {
+      ReleaseSource(*node->parent);
+    }
+
+    if (opened) {
+      CopyEntries(node);
+    }
+    ReleaseSource(*node);
+
+    FinishCopy(node);
+  }
+
+  bool OpenCopyDirectories(Node &node) {
+    const char *name = node.name.c_str();
+    const char *target_name = node.parent ? name : target_path_;
+
+    int source_fd = ::openat(SourceParent(node), name, kDirectoryFlags);
+    if (source_fd == -1) {
+      Fail(LastError());
+      return false;
+    }
+    node.source.emplace(Directory{source_fd});
+
+    struct stat info;
+    if (0 != ::fstat(source_fd, &info)) {
+      Fail(LastError());
+      return false;
+    }
+
+    const int target_parent_fd =
+        node.parent ? node.parent->target->fd_ : AT_FDCWD;
+    // Writable until done, whatever the source permissions are
+    if (0 != ::mkdirat(target_parent_fd, target_name,
+                       (info.st_mode & 07777) | S_IRWXU)) {
+      Fail(LastError());
+      return false;
+    }
+
+    int target_fd = ::openat(target_parent_fd, target_name, kDirectoryFlags);
+    if (target_fd == -1) {
+      Fail(LastError());
+      return false;
+    }
+    node.target.emplace(Directory{target_fd});
+    node.mode = info.st_mode & 07777;
+
+    return true;
+  }
+
+  void CopyEntries(const std::shared_ptr<Node> &node) {
+    const int source_fd = node->source->fd_;
+    const int target_fd = node->target->fd_;
+    auto entries = node->source->Enumerate();
+    if (!entries) {
+      Fail(entries.Code());
+      return;
+    }
+
+    for (const DirectoryEntry &entry : *entries) {
+      if (Failed()) {
+        return;
+      }
+
+      switch (EntryFormat(source_fd, entry)) {
+        case S_IFDIR:
+          Spawn(node, entry.name);
+          break;
+        case S_IFREG:
+          if (auto error = CopyRegularFile(source_fd, target_fd, entry)) {
+            Fail(error);
+          }
+          break;
+        case S_IFLNK:
+          if (auto error = CopySymbolicLink(source_fd, target_fd, entry)) {
+            Fail(error);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    if (entries->Error()) {
+      Fail(entries->Error());
+    }
+  }
+
+  std::error_code CopyRegularFile(int source_fd, int target_fd,
+                                  const DirectoryEntry &entry) {
+    const char *name = entry.name.data();
+
+    int in_fd = ::openat(source_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in_fd == -1) {
+      return LastError();
+    }
+    File in_file = File::WithDescriptor(in_fd);
+
+    struct stat info;
+    if (0 != ::fstat(in_fd, &info)) {
+      return LastError();
+    }
+
+    int out_fd = ::openat(target_fd, name,
+                          O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                          info.st_mode & 07777);
+    if (out_fd == -1) {
+      return LastError();
+    }
+    File out_file = File::WithDescriptor(out_fd);
+
+    Result<uint64_t> copied = CopyFileContents(in_file, out_file);
+    if (!copied) {
+      return copied.Code();
+    }
+
+    Count(*copied);
+    return {};
+  }
+
+  std::error_code CopySymbolicLink(int source_fd, int target_fd,
+                                   const DirectoryEntry &entry) {
+    char link[MAXPATHLEN];
+    ssize_t length =
+        ::readlinkat(source_fd, entry.name.data(), link, sizeof(link) - 1);
+    if (length < 0) {
+      return LastError();
+    }
+    link[length] = '\0';
+
+    if (0 != ::symlinkat(link, target_fd, entry.name.data())) {
+      return LastError();
+    }
+
+    Count(0);
+    return {};
+  }
+
+  void FinishCopy(const std::shared_ptr<Node> &node) {
+    if (node->pending.fetch_sub(1) != 1) {
+      return;
+    }
+
+    if (node->target && !Failed()) {
+      if (0 == ::fchmod(node->target->fd_, node->mode)) {
+        Count(0);
+      } else {
+        Fail(LastError());
+      }
+    }
+
+    node->target.reset();
+
+    if (node->parent) {
+      FinishCopy(node->parent);
+    }
+  }
+
+  const TreeProgressHandler &progress_;
+  const Visit visit_;
+  const char *target_path_ = nullptr;
+  dispatch::Queue queue_;
+  dispatch::Group group_;
+  Sync<Work> work_;
+  std::atomic<bool> failed_{false};
+  Sync<std::error_code> error_;
+  std::atomic<uint64_t> entries_{0};
+  std::atomic<uint64_t> bytes_{0};
+};
+
+std::error_code Directory::RemoveTree(
+    const FilePath &path, const TreeProgressHandler &progress) noexcept {
+  struct stat info;
+  if (0 != ::lstat(path.CString(), &info)) {
+    return LastError();
+  }
+  if (!S_ISDIR(info.st_mode)) {
+    return (0 == ::unlink(path.CString())) ? std::error_code{} : LastError();
+  }
+
+  TreeWalk walk{progress, &TreeWalk::RemoveDirectory};
+
+  auto root = std::make_shared<TreeWalk::Node>();
+  root->name = path.String();
+  walk.RemoveDirectory(root);
+
+  return walk.Wait();
+}
+
+std::error_code Directory::CopyTree(
+    const FilePath &from, const FilePath &to,
+    const TreeProgressHandler &progress) noexcept {
+  TreeWalk walk{progress, &TreeWalk::CopyDirectory};
+  walk.target_path_ = to.CString();
+
+  auto root = std::make_shared<TreeWalk::Node>();
+  root->name = from.String();
+  walk.CopyDirectory(root);
+
+  return walk.Wait();
+}
+
+}  // namespace mcom
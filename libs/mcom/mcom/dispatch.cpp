@@ -72,6 +72,10 @@ bool Group::Wait(const Time &time) {
 
 Semaphore::Semaphore(long count) : sema_(dispatch_semaphore_create(count)) {}
 
+Semaphore::Semaphore(long count, const char *name)
+    : sema_(dispatch_semaphore_create(count)),
+      site_{mcom::LockSite::Named(name)} {}
+
 Semaphore::~Semaphore() { dispatch_release(sema_); }
 
 bool Semaphore::Wait(const Time &time) {
@@ -80,6 +84,19 @@ bool Semaphore::Wait(const Time &time) {
 
 bool Semaphore::Signal() { return (0 != dispatch_semaphore_signal(sema_)); }
 
+void Semaphore::Acquire(mcom::LockProbe &probe) {
+  if (!probe.Enabled()) {
+    Wait(Time::kForever);
+    return;
+  }
+
+  const bool contended = !Wait(Time::Now());
+  if (contended) {
+    Wait(Time::kForever);
+  }
+  probe.Acquired(contended);
+}
+
 Source::Source(Source &&other) : source_{other.source_} {
   other.source_ = nullptr;
 }
@@ -126,4 +143,13 @@ ProcessExitSource::ProcessExitSource(pid_t pid,
                                     DISPATCH_PROC_EXIT,
                                     queue ? queue->operator*() : nullptr)} {}
 
+ReadSource::ReadSource(int fd, const std::optional<Queue> &queue)
+    : Source{dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, uintptr_t(fd),
+                                    0, queue ? queue->operator*() : nullptr)} {}
+
+SignalSource::SignalSource(int signal, const std::optional<Queue> &queue)
+    : Source{dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL,
+                                    uintptr_t(signal), 0,
+                                    queue ? queue->operator*() : nullptr)} {}
+
 }  // namespace dispatch
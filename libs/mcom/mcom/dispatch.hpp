@@ -25,6 +25,8 @@
 
 #include <dispatch/dispatch.h>
 
+#include <mcom/lock_profiling.hpp>
+
 namespace dispatch {
 
 #define MCOM_ONCE(...)                         \
@@ -70,6 +72,10 @@ class Duration {
     return Duration{count * int64_t(NSEC_PER_SEC)};
   }
 
+  inline static Duration Milliseconds(int64_t count) {
+    return Duration{count * int64_t(NSEC_PER_MSEC)};
+  }
+
   int64_t Count() const { return count_; }
 
  private:
@@ -121,6 +127,9 @@ class Group {
 class Semaphore {
  public:
   Semaphore(long count);
+  // Named semaphores are tracked by lock profiling when they are taken
+  // through a Guard.
+  Semaphore(long count, const char *name);
   Semaphore(const Semaphore &);
   Semaphore(Semaphore &&);
   ~Semaphore();
@@ -131,18 +140,24 @@ class Semaphore {
 
   class Guard {
    public:
-    Guard(Semaphore &sema) : sema_{sema} { sema_.Wait(Time::kForever); }
+    Guard(Semaphore &sema) : sema_{sema}, probe_{sema.site_} {
+      sema_.Acquire(probe_);
+    }
 
     ~Guard() { sema_.Signal(); }
 
    private:
     Semaphore &sema_;
+    mcom::LockProbe probe_;
   };
 
   Guard Lock() { return {*this}; }
 
  private:
+  void Acquire(mcom::LockProbe &probe);
+
   dispatch_semaphore_t sema_;
+  mcom::LockSite *site_ = nullptr;
 };
 
 class Source {
@@ -169,6 +184,8 @@ class Source {
   friend class Timer;
   friend class MachReceiveSource;
   friend class ProcessExitSource;
+  friend class ReadSource;
+  friend class SignalSource;
 
   Source(dispatch_source_t source) : source_{source} {}
 
@@ -194,6 +211,20 @@ class ProcessExitSource : public Source {
                     const std::optional<Queue> &queue = std::nullopt);
 };
 
+// Fires while data can be read from the descriptor. Close the descriptor in
+// the cancel handler, not before.
+class ReadSource : public Source {
+ public:
+  ReadSource(int fd, const std::optional<Queue> &queue = std::nullopt);
+};
+
+// Fires after the process receives the signal. The signal's own disposition
+// still applies, so set it to SIG_IGN unless it should run as well.
+class SignalSource : public Source {
+ public:
+  SignalSource(int signal, const std::optional<Queue> &queue = std::nullopt);
+};
+
 template <class Fn>
 auto Once(dispatch_once_t &token, Fn &&fn) -> decltype(fn()) & {
   using value_type = decltype(fn());
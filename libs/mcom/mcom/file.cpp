@@ -21,10 +21,13 @@
 
 #include <copyfile.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include <utility>
+
 namespace mcom {
 
 namespace {
@@ -60,15 +63,50 @@ int MakeFlags(File::Flags flags) {
   return res;
 }
 
+int MakeAdvice(File::Access access) {
+  switch (access) {
+    case File::Access::Normal:
+      return MADV_NORMAL;
+    case File::Access::Sequential:
+      return MADV_SEQUENTIAL;
+    case File::Access::Random:
+      return MADV_RANDOM;
+  }
+  return MADV_NORMAL;
+}
+
+constexpr size_t kStreamBufferSize = 0x10000;
+
+// Whole-file copies replace the destination, so they are used only where
+// the result is the same as copying from the current offsets.
+bool CanCopyWholeFile(int in_fd, int out_fd) noexcept {
+  struct stat info;
+  return 0 == ::lseek(in_fd, 0, SEEK_CUR) &&
+         0 == ::lseek(out_fd, 0, SEEK_CUR) && 0 == ::fstat(out_fd, &info) &&
+         info.st_size == 0;
+}
+
+// Leaves both offsets past the data, as copying through them would.
+Result<uint64_t> FinishWholeFileCopy(int in_fd, int out_fd) noexcept {
+  struct stat info;
+  if (0 != ::fstat(out_fd, &info) ||
+      -1 == ::lseek(in_fd, info.st_size, SEEK_SET) ||
+      -1 == ::lseek(out_fd, info.st_size, SEEK_SET)) {
+    return std::make_error_code(std::errc(errno));
+  }
+  return uint64_t(info.st_size);
+}
+
 }  // namespace
 
 namespace file_details {
 
-FileBuffer::FileBuffer(int fd) : fd_{fd}, buffer_{new char[4096]} {}
+FileBuffer::FileBuffer(int fd)
+    : fd_{fd}, buffer_{new char[kStreamBufferSize]} {}
 
 FileBuffer::FileBuffer(FileBuffer &&other)
     : fd_{other.fd_}, buffer_{std::move(other.buffer_)} {
-  fd_ = -1;
+  other.fd_ = -1;
 }
 
 FileBuffer::~FileBuffer() {
@@ -80,7 +118,7 @@ FileBuffer::~FileBuffer() {
 int FileBuffer::underflow() {
   auto buffer_base = buffer_.get();
 
-  ssize_t read_res = ::read(fd_, buffer_base, 4096);
+  ssize_t read_res = ::read(fd_, buffer_base, kStreamBufferSize);
   if (read_res <= 0) {
     return traits_type::eof();
   }
@@ -90,6 +128,29 @@ int FileBuffer::underflow() {
 
 }  // namespace file_details
 
+FileMapping::FileMapping(FileMapping &&other) noexcept
+    : data_{other.data_}, size_{other.size_} {
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+FileMapping &FileMapping::operator=(FileMapping &&other) noexcept {
+  if (this != &other) {
+    if (data_) {
+      ::munmap(const_cast<uint8_t *>(data_), size_);
+    }
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+FileMapping::~FileMapping() {
+  if (data_) {
+    ::munmap(const_cast<uint8_t *>(data_), size_);
+  }
+}
+
 IOStream::IOStream(int fd)
     : file_details::FileBuffer{fd}, std::iostream{this} {}
 
@@ -146,24 +207,61 @@ Result<size_t> File::Read(void *bytes, size_t length) noexcept {
 }
 
 Result<std::vector<uint8_t>> File::ReadAll() noexcept {
-  constexpr size_t buffer_size = 0x100000;
-  std::unique_ptr<uint8_t[]> buffer{new uint8_t[buffer_size]};
-  std::vector<uint8_t> result;
+  // Regular files are read straight into a result of their final size;
+  // pipes and the like report no size and grow as they are read.
+  size_t capacity = 0;
+  if (auto attributes = GetAttributes();
+      attributes && attributes->type == Type::Regular) {
+    capacity = attributes->size;
+  }
+
+  // One spare byte lets the final read observe end of file without growing
+  std::vector<uint8_t> result(capacity > 0 ? capacity + 1
+                                           : kStreamBufferSize);
+  size_t size = 0;
 
   while (true) {
-    Result<size_t> read_size = Read(buffer.get(), buffer_size);
-    if (read_size == 0) {
-      break;
-    } else if (read_size > 0) {
-      result.insert(result.end(), buffer.get(), buffer.get() + *read_size);
-    } else if (!read_size) {
+    if (size == result.size()) {
+      result.resize(result.size() * 2);
+    }
+
+    Result<size_t> read_size =
+        Read(result.data() + size, result.size() - size);
+    if (!read_size) {
       return read_size.Code();
+    } else if (*read_size == 0) {
+      break;
     }
+    size += *read_size;
   }
 
+  result.resize(size);
+
   return std::move(result);
 }
 
+Result<FileMapping> File::Map(Access access) noexcept {
+  Result<Attributes> attributes = GetAttributes();
+  if (!attributes) {
+    return attributes.Code();
+  }
+  if (attributes->type != Type::Regular) {
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  if (attributes->size == 0) {
+    return FileMapping{};
+  }
+
+  void *address = ::mmap(nullptr, attributes->size, PROT_READ, MAP_PRIVATE,
+                         fd_, 0);
+  if (address == MAP_FAILED) {
+    return std::make_error_code(std::errc(errno));
+  }
+  ::madvise(address, attributes->size, MakeAdvice(access));
+
+  return FileMapping{static_cast<const uint8_t *>(address), attributes->size};
+}
+
 std::error_code File::Write(const void *bytes, size_t length) noexcept {
   auto base = static_cast<const uint8_t *>(bytes);
   size_t written = 0;
@@ -172,7 +270,10 @@ std::error_code File::Write(const void *bytes, size_t length) noexcept {
     ssize_t res = ::write(fd_, base + written, length - written);
 
     if (res < 0) {
-      std::make_error_code(std::errc(errno));
+      if (errno == EINTR) {
+        continue;
+      }
+      return std::make_error_code(std::errc(errno));
     }
 
     written += size_t(res);
@@ -260,6 +361,39 @@ std::error_code CopyFile(const mcom::FilePath &src,
   return {};
 }
 
+Result<uint64_t> CopyFileContents(File &from, File &to) noexcept {
+  const int in_fd = from.Descriptor();
+  const int out_fd = to.Descriptor();
+
+  if (CanCopyWholeFile(in_fd, out_fd)) {
+    if (0 != ::fcopyfile(in_fd, out_fd, nullptr, COPYFILE_DATA)) {
+      return std::error_code{errno, std::system_category()};
+    }
+    return FinishWholeFileCopy(in_fd, out_fd);
+  }
+
+  constexpr size_t buffer_size = 0x20000;
+  std::unique_ptr<uint8_t[]> buffer{new (std::nothrow) uint8_t[buffer_size]};
+  if (!buffer) {
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+
+  uint64_t total = 0;
+  while (true) {
+    Result<size_t> read_size = from.Read(buffer.get(), buffer_size);
+    if (!read_size) {
+      return read_size.Code();
+    } else if (*read_size == 0) {
+      return total;
+    }
+
+    if (auto error = to.Write(buffer.get(), *read_size)) {
+      return error;
+    }
+    total += *read_size;
+  }
+}
+
 Result<std::vector<uint8_t>> GetExtendedAttribute(const mcom::FilePath &path,
                                                   const std::string &name) {
   std::vector<uint8_t> value_buffer;
@@ -49,6 +49,32 @@ class FileBuffer : public std::streambuf {
 
 }  // namespace file_details
 
+// Read-only view of a file's contents, unmapped on destruction. An empty
+// file maps to an empty range.
+class FileMapping {
+ public:
+  FileMapping() noexcept : data_{nullptr}, size_{0} {}
+  FileMapping(const FileMapping &) = delete;
+  FileMapping(FileMapping &&other) noexcept;
+  FileMapping &operator=(FileMapping &&other) noexcept;
+  ~FileMapping();
+
+  const uint8_t *Data() const noexcept { return data_; }
+
+  size_t Size() const noexcept { return size_; }
+
+  bool Empty() const noexcept { return size_ == 0; }
+
+ private:
+  friend class File;
+
+  FileMapping(const uint8_t *data, size_t size) noexcept
+      : data_{data}, size_{size} {}
+
+  const uint8_t *data_;
+  size_t size_;
+};
+
 class IOStream : protected file_details::FileBuffer, public std::iostream {
  public:
   IOStream(const IOStream &) = delete;
@@ -107,6 +133,9 @@ class File {
 
   enum class Type { Unknown, Regular, Directory };
 
+  // How a mapping is going to be read, passed on to madvise
+  enum class Access { Normal, Sequential, Random };
+
   struct Attributes {
     size_t size;
     Type type;
@@ -125,6 +154,10 @@ class File {
 
   Result<std::vector<uint8_t>> ReadAll() noexcept;
 
+  // The file must be a regular one; the mapping stays valid after the file
+  // is closed.
+  Result<FileMapping> Map(Access access = Access::Sequential) noexcept;
+
   std::error_code Write(const void *bytes, size_t length) noexcept;
 
   Result<Attributes> GetAttributes() noexcept;
@@ -154,6 +187,12 @@ Result<std::pair<File, File>> Pipe() noexcept;
 std::error_code CopyFile(const mcom::FilePath &src,
                          const mcom::FilePath &dst) noexcept;
 
+// Copies the data from the current offset of `from` to the current offset
+// of `to` and leaves both offsets past the copied data. When both are at the
+// start and `to` is empty, the data is copied with fcopyfile instead.
+// Returns the number of bytes copied.
+Result<uint64_t> CopyFileContents(File &from, File &to) noexcept;
+
 Result<std::vector<uint8_t>> GetExtendedAttribute(const mcom::FilePath &path,
                                                   const std::string &name);
 
@@ -19,91 +19,257 @@
 
 #include "file_path.hpp"
 
+#include <stdlib.h>
+
+#include <cerrno>
+#include <memory>
+
+#include <mcom/string.hpp>
+
 namespace mcom {
 
-FilePath::FilePath(std::string_view path) : path_(path) {}
+namespace {
 
-FilePath::FilePath(const FilePath &path) : path_(path.path_) {}
+// End of the basename, after skipping trailing separators; 0 if the path
+// consists of separators only
+size_t BasenameEnd(std::string_view path) {
+  size_t end = path.size();
+  while (end > 0 && path[end - 1] == '/') {
+    --end;
+  }
+  return end;
+}
 
-FilePath::FilePath(FilePath &&path) : path_(std::move(path.path_)) {}
+bool IsDotComponent(std::string_view component) {
+  return component == "." || component == "..";
+}
 
-FilePath &FilePath::operator=(const FilePath &other) {
-  path_ = other.path_;
-  return *this;
+bool IsNormalPath(std::string_view path) {
+  if (path.size() > 1 && path.back() == '/') {
+    return false;
+  }
+
+  size_t begin = 0;
+  while (begin < path.size()) {
+    auto end = FindChar(path, '/', begin);
+    if (end == std::string_view::npos) {
+      end = path.size();
+    }
+
+    // Empty components come from repeated separators, except for the root
+    if ((end == begin && begin != 0) ||
+        IsDotComponent(path.substr(begin, end - begin))) {
+      return false;
+    }
+
+    begin = end + 1;
+  }
+
+  return true;
 }
 
-FilePath &FilePath::operator=(FilePath &&path) {
-  path_ = std::move(path.path_);
-  return *this;
+}  // namespace
+
+std::string NormalizePath(std::string_view path) {
+  if (IsNormalPath(path)) {
+    return std::string{path};
+  }
+
+  const bool absolute = path.front() == '/';
+  const size_t root_size = absolute ? 1 : 0;
+
+  std::string result;
+  result.reserve(path.size());
+  if (absolute) {
+    result.push_back('/');
+  }
+
+  // Trailing ".." components that couldn't be resolved, relative paths only
+  size_t unresolved_size = root_size;
+
+  for (std::string_view component : FilePathView{path}.Components()) {
+    if (component == ".") {
+      continue;
+    }
+
+    if (component == "..") {
+      if (result.size() > unresolved_size) {
+        const auto sep = result.rfind('/');
+        result.resize((sep == std::string::npos || sep < root_size) ? root_size
+                                                                    : sep);
+        continue;
+      }
+      if (absolute) {
+        continue;
+      }
+    }
+
+    if (result.size() > root_size) {
+      result.push_back('/');
+    }
+    result.append(component);
+
+    if (component == "..") {
+      unresolved_size = result.size();
+    }
+  }
+
+  if (result.empty()) {
+    result = ".";
+  }
+
+  return result;
 }
 
-FilePath FilePath::Dirname() const noexcept {
+void FilePathView::ComponentIterator::Seek(size_t offset) noexcept {
+  while (offset < path_.size() && path_[offset] == '/') {
+    ++offset;
+  }
+  auto end = FindChar(path_, '/', offset);
+  if (end == std::string_view::npos) {
+    end = path_.size();
+  }
+  component_ = path_.substr(offset, end - offset);
+}
+
+FilePathView FilePathView::Dirname() const noexcept {
   // Find the last separator
   auto sep = path_.find_last_of('/');
-  if (sep == std::string::npos) {
+  if (sep == std::string_view::npos) {
     // No separator: path is relative
-    return FilePath{"."};
+    return ".";
   }
 
   if (sep == 0) {
-    return FilePath{"/"};
+    return "/";
   }
 
-  return FilePath{path_.substr(0, sep)};
+  return path_.substr(0, sep);
 }
 
-FilePath FilePath::Basename() const noexcept {
+FilePathView FilePathView::Basename() const noexcept {
   if (path_.empty()) {
     return *this;
   }
 
-  auto begin = path_.cbegin();
-  auto end = path_.cend();
+  const size_t end = BasenameEnd(path_);
+  if (end == 0) {
+    return "/";
+  }
+
+  const auto sep = path_.find_last_of('/', end - 1);
+  const size_t begin = (sep == std::string_view::npos) ? 0 : sep + 1;
 
-  // FIXME: Maybe do it in constructors?
-  // Skip trailing separators
-  while (end[-1] == '/') {
-    end--;
-    if (end == begin) {
-      return FilePath{"/"};
-    }
+  return path_.substr(begin, end - begin);
+}
+
+std::pair<FilePathView, FilePathView> FilePathView::Split() const noexcept {
+  if (path_.empty()) {
+    return {".", *this};
+  }
+
+  const size_t end = BasenameEnd(path_);
+  if (end == 0) {
+    return {"/", "/"};
   }
 
-  // Find basename start
-  auto bn_begin = end;
-  while (bn_begin != begin && bn_begin[-1] != '/') {
-    bn_begin--;
+  const auto sep = path_.find_last_of('/', end - 1);
+  if (sep == std::string_view::npos) {
+    return {"./", path_.substr(0, end)};
   }
 
-  return FilePath{std::string{bn_begin, end}};
+  return {path_.substr(0, sep + 1), path_.substr(sep + 1, end - sep - 1)};
 }
 
-std::pair<FilePath, FilePath> FilePath::Split() const noexcept {
-  if (path_.empty()) {
-    return {FilePath{"."}, *this};
+bool FilePathView::HasPrefix(FilePathView prefix) const noexcept {
+  return RelativeTo(prefix).has_value();
+}
+
+std::optional<FilePathView> FilePathView::RelativeTo(
+    FilePathView prefix) const noexcept {
+  if (prefix.IsAbsolute() != IsAbsolute()) {
+    return std::nullopt;
   }
 
-  auto begin = path_.cbegin();
-  auto end = path_.cend();
+  const auto components = Components();
+  auto it = components.begin();
 
-  // FIXME: Maybe do it in constructors?
-  // Skip trailing separators
-  while (end[-1] == '/') {
-    end--;
-    if (end == begin) {
-      return {FilePath{"/"}, FilePath{"/"}};
+  for (std::string_view prefix_component : prefix.Components()) {
+    if (it == components.end() || *it != prefix_component) {
+      return std::nullopt;
     }
+    ++it;
+  }
+
+  return FilePathView{path_.substr(it.Offset())};
+}
+
+std::string_view FilePathView::Extension() const noexcept {
+  const auto basename = Basename().String();
+
+  const auto dot = basename.rfind('.');
+  if (dot == std::string_view::npos || dot == 0) {
+    return {};
+  }
+
+  return basename.substr(dot + 1);
+}
+
+bool operator==(FilePathView lhs, FilePathView rhs) {
+  return lhs.String() == rhs.String();
+}
+
+bool operator!=(FilePathView lhs, FilePathView rhs) {
+  return lhs.String() != rhs.String();
+}
+
+FilePath::FilePath(std::string_view path) : path_(path) {}
+
+FilePath::FilePath(const FilePath &path) : path_(path.path_) {}
+
+FilePath::FilePath(FilePath &&path) : path_(std::move(path.path_)) {}
+
+FilePath &FilePath::operator=(const FilePath &other) {
+  path_ = other.path_;
+  return *this;
+}
+
+FilePath &FilePath::operator=(FilePath &&path) {
+  path_ = std::move(path.path_);
+  return *this;
+}
+
+FilePath FilePath::Dirname() const noexcept {
+  return FilePath{View().Dirname().String()};
+}
+
+FilePath FilePath::Basename() const noexcept {
+  return FilePath{View().Basename().String()};
+}
+
+std::vector<FilePath> FilePath::Components() const noexcept {
+  std::vector<FilePath> components;
+  for (std::string_view component : View().Components()) {
+    components.emplace_back(component);
   }
+  return components;
+}
+
+std::pair<FilePath, FilePath> FilePath::Split() const noexcept {
+  const auto [dirname, basename] = View().Split();
+  return {FilePath{dirname.String()}, FilePath{basename.String()}};
+}
+
+FilePath FilePath::Normalized() const { return FilePath{NormalizePath(path_)}; }
 
-  // Find basename start
-  auto bn_begin = end;
-  while (bn_begin != begin && bn_begin[-1] != '/') {
-    bn_begin--;
+Result<FilePath> FilePath::Canonical() const noexcept {
+  std::unique_ptr<char, decltype(&::free)> resolved{
+      ::realpath(path_.c_str(), nullptr), &::free};
+  if (!resolved) {
+    return std::make_error_code(std::errc(errno));
   }
 
-  auto dirname = bn_begin == begin ? FilePath{"./"}
-                                   : FilePath{std::string{begin, bn_begin}};
-  return {dirname, FilePath{std::string{bn_begin, end}}};
+  return FilePath{resolved.get()};
 }
 
 FilePath operator+(const FilePath &path, const char *str) {
@@ -19,10 +19,127 @@
 
 #pragma once
 
+#include <iterator>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <mcom/result.hpp>
 
 namespace mcom {
 
+class FilePath;
+
+// Non-owning path. Every operation returns views into the same characters,
+// so nothing here allocates.
+class FilePathView {
+ public:
+  // Iterates over the non-empty components: "/usr//local/" gives "usr" and
+  // "local".
+  class ComponentIterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view *;
+    using reference = const std::string_view &;
+
+    ComponentIterator() noexcept = default;
+
+    reference operator*() const noexcept { return component_; }
+    pointer operator->() const noexcept { return &component_; }
+
+    ComponentIterator &operator++() noexcept {
+      Seek(Offset() + component_.size());
+      return *this;
+    }
+
+    ComponentIterator operator++(int) noexcept {
+      auto copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    bool operator==(const ComponentIterator &other) const noexcept {
+      return component_.data() == other.component_.data();
+    }
+    bool operator!=(const ComponentIterator &other) const noexcept {
+      return !(*this == other);
+    }
+
+    // Offset of the current component, or the path size at the end
+    size_t Offset() const noexcept {
+      return size_t(component_.data() - path_.data());
+    }
+
+   private:
+    friend class FilePathView;
+
+    ComponentIterator(std::string_view path, size_t offset) noexcept
+        : path_{path} {
+      Seek(offset);
+    }
+
+    void Seek(size_t offset) noexcept;
+
+    std::string_view path_;
+    std::string_view component_;
+  };
+
+  class ComponentRange {
+   public:
+    ComponentIterator begin() const noexcept { return {path_, 0}; }
+    ComponentIterator end() const noexcept { return {path_, path_.size()}; }
+
+   private:
+    friend class FilePathView;
+
+    explicit ComponentRange(std::string_view path) noexcept : path_{path} {}
+
+    std::string_view path_;
+  };
+
+  constexpr FilePathView() noexcept = default;
+  constexpr FilePathView(std::string_view path) noexcept : path_{path} {}
+  constexpr FilePathView(const char *path) noexcept : path_{path} {}
+  FilePathView(const FilePath &path) noexcept;
+
+  std::string_view String() const noexcept { return path_; }
+
+  bool Empty() const noexcept { return path_.empty(); }
+
+  bool IsAbsolute() const noexcept {
+    return !path_.empty() && path_.front() == '/';
+  }
+
+  // Same results as the FilePath counterparts
+  FilePathView Dirname() const noexcept;
+  FilePathView Basename() const noexcept;
+  std::pair<FilePathView, FilePathView> Split() const noexcept;
+
+  ComponentRange Components() const noexcept { return ComponentRange{path_}; }
+
+  // Whether `prefix` consists of leading whole components of this path:
+  // "/usr/local" is a prefix of "/usr/local/bin" but not of
+  // "/usr/localized".
+  bool HasPrefix(FilePathView prefix) const noexcept;
+
+  // The part after `prefix`, without leading separators; nullopt when
+  // `prefix` isn't a prefix.
+  std::optional<FilePathView> RelativeTo(FilePathView prefix) const noexcept;
+
+  // Text after the last dot of the basename, empty if there is none
+  std::string_view Extension() const noexcept;
+
+ private:
+  std::string_view path_;
+};
+
+bool operator==(FilePathView lhs, FilePathView rhs);
+bool operator!=(FilePathView lhs, FilePathView rhs);
+
 class FilePath {
  public:
   explicit FilePath(std::string_view path);
@@ -35,15 +152,33 @@ class FilePath {
   const char *CString() const { return path_.c_str(); }
   const std::string &String() const { return path_; }
 
+  FilePathView View() const noexcept { return FilePathView{path_}; }
+
   FilePath Dirname() const noexcept;
   FilePath Basename() const noexcept;
   std::vector<FilePath> Components() const noexcept;
   std::pair<FilePath, FilePath> Split() const noexcept;
 
+  // See NormalizePath()
+  FilePath Normalized() const;
+
+  // Absolute path with symbolic links resolved; the file has to exist.
+  // Touches the file system, see CanonicalPathCache for repeated lookups.
+  Result<FilePath> Canonical() const noexcept;
+
  private:
   std::string path_;
 };
 
+inline FilePathView::FilePathView(const FilePath &path) noexcept
+    : path_{path.String()} {}
+
+// Lexical normalization: repeated separators, "." components and a trailing
+// separator are dropped, and ".." components remove the one before them.
+// Doesn't look at the file system, so "a/link/.." becomes "a" even if
+// "link" is a symbolic link. Already normal paths are copied as they are.
+std::string NormalizePath(std::string_view path);
+
 FilePath operator+(const FilePath &path, const char *str);
 FilePath operator/(const FilePath &dir, const FilePath &name);
 FilePath operator/(const FilePath &dir, const char *str);
@@ -0,0 +1,156 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "lock_profiling.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace mcom {
+
+#if MCOM_LOCK_PROFILING
+
+namespace {
+
+// The registry can't be guarded by dispatch::Semaphore since that would
+// profile itself.
+struct Registry {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::unique_ptr<LockSite>> sites;
+};
+
+Registry &GetRegistry() {
+  // Intentionally leaked: locks may be taken during static destruction.
+  static auto registry = new Registry;
+  return *registry;
+}
+
+void UpdateMax(std::atomic<int64_t> &max, int64_t value) {
+  auto current = max.load(std::memory_order_relaxed);
+  while (current < value &&
+         !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+LockSite *LockSite::Named(const char *name) {
+  if (!name) {
+    return nullptr;
+  }
+
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+
+  auto &site = registry.sites[name];
+  if (!site) {
+    site.reset(new LockSite{name});
+  }
+  return site.get();
+}
+
+void LockSite::Record(bool contended, std::chrono::nanoseconds wait,
+                      std::chrono::nanoseconds hold) {
+  acquisitions_.fetch_add(1, std::memory_order_relaxed);
+  if (contended) {
+    contended_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  wait_total_.fetch_add(wait.count(), std::memory_order_relaxed);
+  UpdateMax(wait_max_, wait.count());
+  hold_total_.fetch_add(hold.count(), std::memory_order_relaxed);
+  UpdateMax(hold_max_, hold.count());
+}
+
+LockSiteStatistics LockSite::Statistics() const {
+  return {name_,
+          acquisitions_.load(std::memory_order_relaxed),
+          contended_.load(std::memory_order_relaxed),
+          std::chrono::nanoseconds{wait_total_.load(std::memory_order_relaxed)},
+          std::chrono::nanoseconds{wait_max_.load(std::memory_order_relaxed)},
+          std::chrono::nanoseconds{hold_total_.load(std::memory_order_relaxed)},
+          std::chrono::nanoseconds{hold_max_.load(std::memory_order_relaxed)}};
+}
+
+void LockSite::Reset() {
+  acquisitions_ = 0;
+  contended_ = 0;
+  wait_total_ = 0;
+  wait_max_ = 0;
+  hold_total_ = 0;
+  hold_max_ = 0;
+}
+
+std::vector<LockSiteStatistics> LockProfileSnapshot() {
+  std::vector<LockSiteStatistics> result;
+
+  auto &registry = GetRegistry();
+  {
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    result.reserve(registry.sites.size());
+    for (auto &kv : registry.sites) {
+      result.push_back(kv.second->Statistics());
+    }
+  }
+
+  std::sort(result.begin(), result.end(),
+            [](auto &lhs, auto &rhs) { return lhs.name < rhs.name; });
+  return result;
+}
+
+void ResetLockProfile() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+  for (auto &kv : registry.sites) {
+    kv.second->Reset();
+  }
+}
+
+#else
+
+std::vector<LockSiteStatistics> LockProfileSnapshot() { return {}; }
+
+void ResetLockProfile() {}
+
+#endif
+
+void DumpLockProfile(std::FILE *file) {
+  const auto us = [](std::chrono::nanoseconds duration) {
+    return duration.count() / 1000.0;
+  };
+
+  std::fprintf(file, "%-32s %12s %12s %12s %12s %12s %12s\n", "lock",
+               "acquired", "contended", "wait avg us", "wait max us",
+               "hold avg us", "hold max us");
+
+  for (auto &site : LockProfileSnapshot()) {
+    const auto count = std::max<uint64_t>(site.acquisitions, 1);
+    std::fprintf(file,
+                 "%-32s %12" PRIu64 " %12" PRIu64
+                 " %12.1f %12.1f %12.1f %12.1f\n",
+                 site.name.c_str(), site.acquisitions, site.contended,
+                 us(site.wait_total) / count, us(site.wait_max),
+                 us(site.hold_total) / count, us(site.hold_max));
+  }
+}
+
+}  // namespace mcom
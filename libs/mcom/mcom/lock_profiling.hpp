@@ -0,0 +1,138 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Build with MCOM_LOCK_PROFILING=1 to record acquisition counts, wait and
+// hold times for every named lock. Unnamed locks are never profiled, and in
+// regular builds the hooks compile to nothing.
+#ifndef MCOM_LOCK_PROFILING
+#define MCOM_LOCK_PROFILING 0
+#endif
+
+namespace mcom {
+
+// Tag used to give a Sync or SharedSync a lock site name.
+struct LockName {
+  const char *value;
+};
+
+struct LockSiteStatistics {
+  std::string name;
+  uint64_t acquisitions;
+  // Acquisitions that found the lock already taken.
+  uint64_t contended;
+  std::chrono::nanoseconds wait_total;
+  std::chrono::nanoseconds wait_max;
+  std::chrono::nanoseconds hold_total;
+  std::chrono::nanoseconds hold_max;
+};
+
+#if MCOM_LOCK_PROFILING
+
+// Aggregated statistics of all locks sharing a name. Sites are created on
+// first use and live until the process exits.
+class LockSite {
+ public:
+  static LockSite *Named(const char *name);
+
+  void Record(bool contended, std::chrono::nanoseconds wait,
+              std::chrono::nanoseconds hold);
+
+  LockSiteStatistics Statistics() const;
+
+  void Reset();
+
+ private:
+  explicit LockSite(std::string name) : name_{std::move(name)} {}
+
+  const std::string name_;
+  std::atomic<uint64_t> acquisitions_{0};
+  std::atomic<uint64_t> contended_{0};
+  std::atomic<int64_t> wait_total_{0};
+  std::atomic<int64_t> wait_max_{0};
+  std::atomic<int64_t> hold_total_{0};
+  std::atomic<int64_t> hold_max_{0};
+};
+
+// Measures a single acquisition: construct it right before taking the lock,
+// call Acquired() once the lock is held and destroy it after releasing.
+class LockProbe {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit LockProbe(LockSite *site)
+      : site_{site}, start_{site ? Clock::now() : Clock::time_point{}} {}
+
+  ~LockProbe() {
+    if (site_) {
+      site_->Record(contended_, acquired_ - start_, Clock::now() - acquired_);
+    }
+  }
+
+  LockProbe &operator=(LockProbe &&) = delete;
+
+  bool Enabled() const { return site_ != nullptr; }
+
+  void Acquired(bool contended) {
+    contended_ = contended;
+    acquired_ = Clock::now();
+  }
+
+ private:
+  LockSite *const site_;
+  const Clock::time_point start_;
+  Clock::time_point acquired_;
+  bool contended_ = false;
+};
+
+#else
+
+class LockSite {
+ public:
+  static LockSite *Named(const char *) { return nullptr; }
+};
+
+class LockProbe {
+ public:
+  explicit LockProbe(LockSite *) {}
+
+  constexpr bool Enabled() const { return false; }
+
+  void Acquired(bool) {}
+};
+
+#endif
+
+// Statistics of every lock site seen so far, sorted by name. Empty unless the
+// library is built with MCOM_LOCK_PROFILING.
+std::vector<LockSiteStatistics> LockProfileSnapshot();
+
+void ResetLockProfile();
+
+void DumpLockProfile(std::FILE *file);
+
+}  // namespace mcom
@@ -19,22 +19,61 @@
 
 #include "mcom/process.hpp"
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <mcom/dispatch.hpp>
+
+#if defined(__APPLE__)
 #include <libproc.h>
+#include <sys/proc_info.h>
+#endif
 
 namespace {
 
-void ArgvFill(const char *prog, const std::vector<std::string> &args,
-              char **argv) {
-  *argv++ = ::strdup(prog);
-  for (const auto &str : args) {
-    *argv++ = ::strdup(str.c_str());
+// posix_spawn doesn't modify the strings, its signature just lacks const
+std::vector<char *> MakeArgv(const char *prog,
+                             const std::vector<std::string> &args) {
+  std::vector<char *> argv;
+  argv.reserve(args.size() + 2);
+
+  argv.push_back(const_cast<char *>(prog));
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  return argv;
+}
+
+std::error_code LastError() { return {errno, std::system_category()}; }
+
+bool OpenPipe(int fds[2]) {
+#if defined(__linux__)
+  return 0 == ::pipe2(fds, O_CLOEXEC);
+#else
+  if (0 != ::pipe(fds)) {
+    return false;
   }
-  *argv = nullptr;
+  ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#endif
 }
 
-void ArgvRelease(char **argv) {
-  while (*argv) {
-    std::free(*argv++);
+void CloseDescriptor(int &fd) {
+  if (fd != -1) {
+    ::close(fd);
+    fd = -1;
   }
 }
 
@@ -42,6 +81,181 @@ void ArgvRelease(char **argv) {
 
 namespace mcom {
 
+namespace {
+
+// Runs one child on a serial queue: each pipe is read when it becomes
+// readable, the exit is noticed by a process source and the timeout by a
+// timer. Keeps itself alive until the completion has been called.
+class OutputCollector {
+ public:
+  OutputCollector(pid_t pid, int output_fd, int error_fd,
+                  const SubprocessOptions &options,
+                  Subprocess::Completion completion)
+      : pid_{pid},
+        options_{options},
+        streams_{{output_fd, &output_.output},
+                 {error_fd, &output_.error_output}},
+        completion_{std::move(completion)} {}
+
+  static void Start(std::shared_ptr<OutputCollector> collector) {
+    auto &queue = collector->queue_;
+    queue.Async([collector = std::move(collector)]() mutable {
+      auto &self = *collector;
+      self.self_ = std::move(collector);
+      self.Watch();
+    });
+  }
+
+ private:
+  struct Stream {
+    int fd;
+    std::string *data;
+    std::optional<dispatch::ReadSource> source;
+  };
+
+  void Watch() {
+    for (auto &stream : streams_) {
+      ::fcntl(stream.fd, F_SETFL, ::fcntl(stream.fd, F_GETFL) | O_NONBLOCK);
+
+      stream.source.emplace(stream.fd, queue_);
+      stream.source->SetEventHandler([this, &stream]() { Read(stream); });
+      stream.source->SetCancelHandler([fd = stream.fd]() { ::close(fd); });
+      stream.source->Resume();
+    }
+
+    exit_source_.emplace(pid_, queue_);
+    exit_source_->SetEventHandler([this]() { Reap(); });
+    exit_source_->Resume();
+
+    if (options_.timeout) {
+      timer_.emplace(queue_);
+      timer_->SetEventHandler([this]() { Kill(); });
+      timer_->Schedule(dispatch::Time::Now() +
+                       dispatch::Duration::Milliseconds(
+                           std::max<int64_t>(options_.timeout->count(), 0)));
+      timer_->Resume();
+    }
+
+    // The child may have exited before the source was watching
+    Reap();
+  }
+
+  void Read(Stream &stream) {
+    char buffer[0x4000];
+
+    while (stream.source) {
+      const ssize_t size = ::read(stream.fd, buffer, sizeof(buffer));
+      if (size > 0) {
+        const size_t room = options_.max_output_size -
+                            std::min(options_.max_output_size,
+                                     stream.data->size());
+        stream.data->append(buffer, std::min(size_t(size), room));
+        output_.truncated |= size_t(size) > room;
+      } else if (size == 0) {
+        Close(stream);
+      } else if (errno == EINTR) {
+        continue;
+      } else if (errno == EAGAIN) {
+        return;
+      } else {
+        Fail(LastError());
+      }
+    }
+  }
+
+  void Close(Stream &stream) {
+    if (stream.source) {
+      stream.source->Cancel();
+      stream.source.reset();
+    }
+    FinishIfDone();
+  }
+
+  void Reap() {
+    if (pid_ == -1) {
+      return;
+    }
+
+    int status = 0;
+    pid_t result;
+    do {
+      result = ::waitpid(pid_, &status, WNOHANG);
+    } while (result == -1 && errno == EINTR);
+
+    if (result == 0) {
+      return;
+    }
+
+    pid_ = -1;
+    if (result == -1) {
+      error_ = LastError();
+    } else if (WIFSIGNALED(status)) {
+      output_.signal = WTERMSIG(status);
+    } else if (WIFEXITED(status)) {
+      output_.exit_status = WEXITSTATUS(status);
+    }
+
+    exit_source_->Cancel();
+    FinishIfDone();
+  }
+
+  // A killed child's pipes may live on in its own children, so they are
+  // not read any further
+  void Kill() {
+    if (pid_ != -1) {
+      ::kill(pid_, SIGKILL);
+      output_.timed_out = true;
+    }
+    for (auto &stream : streams_) {
+      Close(stream);
+    }
+  }
+
+  void Fail(std::error_code error) {
+    if (!error_) {
+      error_ = error;
+    }
+    if (pid_ != -1) {
+      ::kill(pid_, SIGKILL);
+    }
+    for (auto &stream : streams_) {
+      Close(stream);
+    }
+  }
+
+  void FinishIfDone() {
+    if (pid_ != -1 || streams_[0].source || streams_[1].source || !self_) {
+      return;
+    }
+
+    if (timer_) {
+      timer_->Cancel();
+    }
+
+    if (error_) {
+      completion_(error_);
+    } else {
+      completion_(std::move(output_));
+    }
+
+    // Not before the handler that got here has returned
+    queue_.Async([self = std::move(self_)]() {});
+  }
+
+  dispatch::Queue queue_{"com.paragon-software.mcom.Subprocess"};
+  pid_t pid_;
+  SubprocessOptions options_;
+  SubprocessOutput output_;
+  std::error_code error_;
+  Stream streams_[2];
+  std::optional<dispatch::ProcessExitSource> exit_source_;
+  std::optional<dispatch::Timer> timer_;
+  Subprocess::Completion completion_;
+  std::shared_ptr<OutputCollector> self_;
+};
+
+}  // namespace
+
 FileActions::FileActions() { posix_spawn_file_actions_init(&actions_); }
 
 FileActions::~FileActions() { posix_spawn_file_actions_destroy(&actions_); }
@@ -57,14 +271,11 @@ posix_spawn_file_actions_t *FileActions::Get() const noexcept {
 Result<pid_t> SpawnProcess(const char *prog,
                            const std::vector<std::string> &args,
                            const FileActions &actions) noexcept {
-  char *argv[args.size() + 2];
-
-  ArgvFill(prog, args, argv);
+  auto argv = MakeArgv(prog, args);
 
   pid_t pid;
-  int status = posix_spawn(&pid, prog, actions.Get(), nullptr, argv, nullptr);
-
-  ArgvRelease(argv);
+  int status =
+      posix_spawn(&pid, prog, actions.Get(), nullptr, argv.data(), nullptr);
 
   if (status != 0) {
     return std::make_error_code(std::errc(status));
@@ -93,6 +304,129 @@ std::error_code WaitForProcess(pid_t pid) {
   return {WEXITSTATUS(status), std::system_category()};
 }
 
+Subprocess::Subprocess(pid_t pid, int output_fd, int error_fd,
+                       const SubprocessOptions &options) noexcept
+    : pid_{pid},
+      output_fd_{output_fd},
+      error_fd_{error_fd},
+      options_{options} {}
+
+Subprocess::Subprocess(Subprocess &&other) noexcept
+    : pid_{other.pid_},
+      output_fd_{other.output_fd_},
+      error_fd_{other.error_fd_},
+      options_{other.options_} {
+  other.pid_ = -1;
+  other.output_fd_ = -1;
+  other.error_fd_ = -1;
+}
+
+Subprocess::~Subprocess() {
+  CloseDescriptor(output_fd_);
+  CloseDescriptor(error_fd_);
+
+  if (pid_ != -1) {
+    ::kill(pid_, SIGKILL);
+    int status;
+    while (-1 == ::waitpid(pid_, &status, 0) && errno == EINTR) {
+    }
+  }
+}
+
+Result<Subprocess> Subprocess::Spawn(const char *prog,
+                                     const std::vector<std::string> &args,
+                                     const SubprocessOptions &options) {
+  int output_pipe[2];
+  if (!OpenPipe(output_pipe)) {
+    return LastError();
+  }
+
+  int error_pipe[2];
+  if (!OpenPipe(error_pipe)) {
+    const auto error = LastError();
+    CloseDescriptor(output_pipe[0]);
+    CloseDescriptor(output_pipe[1]);
+    return error;
+  }
+
+  FileActions actions;
+  posix_spawn_file_actions_addopen(actions.Get(), STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  actions.AddDup2(output_pipe[1], STDOUT_FILENO);
+  actions.AddDup2(error_pipe[1], STDERR_FILENO);
+
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+#if defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
+  // Descriptors other threads open meanwhile must not leak into the child
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_CLOEXEC_DEFAULT);
+#endif
+
+  auto argv = MakeArgv(prog, args);
+
+  pid_t pid;
+  int status = posix_spawn(&pid, prog, actions.Get(), &attributes,
+                           argv.data(), nullptr);
+
+  posix_spawnattr_destroy(&attributes);
+  CloseDescriptor(output_pipe[1]);
+  CloseDescriptor(error_pipe[1]);
+
+  if (status != 0) {
+    CloseDescriptor(output_pipe[0]);
+    CloseDescriptor(error_pipe[0]);
+    return std::make_error_code(std::errc(status));
+  }
+
+  return Subprocess{pid, output_pipe[0], error_pipe[0], options};
+}
+
+void Subprocess::Collect(Completion completion) {
+  if (pid_ == -1) {
+    completion(std::make_error_code(std::errc::invalid_argument));
+    return;
+  }
+
+  auto collector = std::make_shared<OutputCollector>(
+      pid_, output_fd_, error_fd_, options_, std::move(completion));
+  pid_ = -1;
+  output_fd_ = -1;
+  error_fd_ = -1;
+
+  OutputCollector::Start(std::move(collector));
+}
+
+Result<SubprocessOutput> Subprocess::Wait() {
+  std::optional<Result<SubprocessOutput>> result;
+  dispatch::Semaphore done{0};
+
+  Collect([&](Result<SubprocessOutput> output) {
+    result.emplace(std::move(output));
+    done.Signal();
+  });
+
+  done.Wait(dispatch::Time::kForever);
+  return *std::move(result);
+}
+
+void RunSubprocess(const std::string &prog,
+                   const std::vector<std::string> &args,
+                   const SubprocessOptions &options,
+                   Subprocess::Completion completion) {
+  auto process = Subprocess::Spawn(prog.c_str(), args, options);
+  if (!process) {
+    dispatch::Queue{}.Async(
+        [completion = std::move(completion), error = process.Code()]() {
+          completion(error);
+        });
+    return;
+  }
+
+  process->Collect(std::move(completion));
+}
+
+#if defined(__APPLE__)
+
 Result<FilePath> ProcessPath(pid_t pid) {
   if (pid <= 0) {
     return std::error_code{EINVAL, std::system_category()};
@@ -107,4 +441,83 @@ Result<FilePath> ProcessPath(pid_t pid) {
   return mcom::FilePath{buffer};
 }
 
+Result<uint64_t> ProcessStartTime(pid_t pid) {
+  if (pid <= 0) {
+    return std::error_code{EINVAL, std::system_category()};
+  }
+
+  proc_bsdinfo info;
+  const auto size = proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &info, sizeof(info));
+  if (size != sizeof(info)) {
+    return std::error_code{size < 0 ? errno : ESRCH, std::system_category()};
+  }
+
+  return info.pbi_start_tvsec * 1000000 + info.pbi_start_tvusec;
+}
+
+#else
+
+Result<FilePath> ProcessPath(pid_t pid) {
+  if (pid <= 0) {
+    return std::error_code{EINVAL, std::system_category()};
+  }
+
+  char link[32];
+  std::snprintf(link, sizeof(link), "/proc/%d/exe", pid);
+
+  char buffer[PATH_MAX];
+  const auto length = ::readlink(link, buffer, sizeof(buffer));
+  if (length < 0) {
+    return std::error_code{errno, std::system_category()};
+  }
+  if (size_t(length) == sizeof(buffer)) {
+    return std::error_code{ENAMETOOLONG, std::system_category()};
+  }
+
+  return mcom::FilePath{std::string_view{buffer, size_t(length)}};
+}
+
+Result<uint64_t> ProcessStartTime(pid_t pid) {
+  if (pid <= 0) {
+    return std::error_code{EINVAL, std::system_category()};
+  }
+
+  char path[32];
+  std::snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+  const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::error_code{errno, std::system_category()};
+  }
+
+  char buffer[1024];
+  const auto length = ::read(fd, buffer, sizeof(buffer) - 1);
+  const int read_error = errno;
+  ::close(fd);
+  if (length <= 0) {
+    return std::error_code{length < 0 ? read_error : EIO,
+                           std::system_category()};
+  }
+  buffer[length] = '\0';
+
+  // The command name may contain spaces and parentheses, the fields we are
+  // interested in follow the last ')'. starttime is field 22, the first
+  // field after the name is field 3.
+  const char *field = std::strrchr(buffer, ')');
+  if (!field) {
+    return std::error_code{EIO, std::system_category()};
+  }
+
+  for (int index = 2; index < 22; ++index) {
+    field = std::strchr(field + 1, ' ');
+    if (!field) {
+      return std::error_code{EIO, std::system_category()};
+    }
+  }
+
+  return std::strtoull(field + 1, nullptr, 10);
+}
+
+#endif
+
 }  // namespace mcom
@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
 #include <vector>
 
 #include <spawn.h>
@@ -50,6 +54,73 @@ Result<pid_t> SpawnProcess(const char *prog,
 
 std::error_code WaitForProcess(pid_t pid);
 
+struct SubprocessOptions {
+  // The child is killed with SIGKILL once this much time has passed
+  std::optional<std::chrono::milliseconds> timeout;
+
+  // Per stream; whatever the child writes beyond that is read and dropped
+  size_t max_output_size = 0x100000;
+};
+
+struct SubprocessOutput {
+  // Set when the child exited normally
+  std::optional<int> exit_status;
+  // Set when the child was killed by a signal, including on timeout
+  std::optional<int> signal;
+  bool timed_out = false;
+
+  std::string output;
+  std::string error_output;
+  bool truncated = false;
+};
+
+// A child process with its stdout and stderr connected to pipes and stdin
+// to /dev/null. Destroying a child that hasn't been waited for kills it.
+class Subprocess {
+ public:
+  using Completion = std::function<void(Result<SubprocessOutput>)>;
+
+  Subprocess(const Subprocess &) = delete;
+  Subprocess(Subprocess &&) noexcept;
+  ~Subprocess();
+
+  static Result<Subprocess> Spawn(const char *prog,
+                                  const std::vector<std::string> &args,
+                                  const SubprocessOptions &options = {});
+
+  // -1 once the child has been handed to Collect
+  pid_t Pid() const noexcept { return pid_; }
+
+  // Reads both streams as they are written, so the child never blocks on
+  // a full pipe, and reaps it. Driven by dispatch sources for the pipes,
+  // the child's exit and the timeout, so no thread waits in the meantime.
+  // `completion` is called once, on a private queue.
+  void Collect(Completion completion);
+
+  // Collect that blocks the calling thread until the result is there.
+  Result<SubprocessOutput> Wait();
+
+ private:
+  Subprocess(pid_t pid, int output_fd, int error_fd,
+             const SubprocessOptions &options) noexcept;
+
+  pid_t pid_;
+  int output_fd_;
+  int error_fd_;
+  SubprocessOptions options_;
+};
+
+// Spawns the child and collects its output without blocking the caller;
+// `completion` is never called on the caller's stack.
+void RunSubprocess(const std::string &prog,
+                   const std::vector<std::string> &args,
+                   const SubprocessOptions &options,
+                   Subprocess::Completion completion);
+
 Result<FilePath> ProcessPath(pid_t pid);
 
+// Opaque start time of a running process. Together with the pid it identifies
+// the process, since pids are reused. It is not changed by exec.
+Result<uint64_t> ProcessStartTime(pid_t pid);
+
 }  // namespace mcom
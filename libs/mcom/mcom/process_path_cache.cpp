@@ -0,0 +1,140 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#include "mcom/process_path_cache.hpp"
+
+#include <algorithm>
+
+#include <mcom/process.hpp>
+
+namespace mcom {
+
+ProcessPathCache::ProcessPathCache(size_t capacity)
+    : capacity_{std::max<size_t>(capacity, 1)},
+      queue_{"mcom.ProcessPathCache"},
+      entries_{LockName{"mcom.ProcessPathCache"}} {}
+
+ProcessPathCache::~ProcessPathCache() {
+  entries_.Use([](Entries &entries) {
+    for (auto &kv : entries.by_pid) {
+      Cancel(kv.second);
+    }
+    entries.by_pid.clear();
+    entries.uses.clear();
+  });
+
+  // Let the handlers that have already been scheduled run out
+  queue_.Sync([]() {});
+}
+
+Result<FilePath> ProcessPathCache::Path(pid_t pid,
+                                        std::optional<uint64_t> start_id) {
+  if (!start_id) {
+    auto start_time = ProcessStartTime(pid);
+    if (!start_time) {
+      return start_time.Code();
+    }
+    start_id = *start_time;
+  }
+
+  auto cached = entries_.Use([&](Entries &entries) -> std::optional<FilePath> {
+    auto it = entries.by_pid.find(pid);
+    if (it != entries.by_pid.end() && it->second.start_id == *start_id) {
+      entries.uses.splice(entries.uses.begin(), entries.uses, it->second.use);
+      return it->second.path;
+    }
+    return std::nullopt;
+  });
+  if (cached) {
+    return std::move(*cached);
+  }
+
+  auto path = ProcessPath(pid);
+  if (!path) {
+    return path;
+  }
+
+  auto exit_source = WatchExit(pid, *start_id);
+
+  entries_.Use([&](Entries &entries) {
+    auto it = entries.by_pid.find(pid);
+    if (it != entries.by_pid.end()) {
+      entries.Erase(it);
+    } else if (entries.by_pid.size() >= capacity_) {
+      entries.Erase(entries.by_pid.find(entries.uses.back()));
+    }
+
+    entries.uses.push_front(pid);
+    entries.by_pid.emplace(pid, Entry{*start_id, *path, std::move(exit_source),
+                                      entries.uses.begin()});
+  });
+
+  return path;
+}
+
+void ProcessPathCache::Evict(pid_t pid) {
+  entries_.Use([&](Entries &entries) {
+    auto it = entries.by_pid.find(pid);
+    if (it != entries.by_pid.end()) {
+      entries.Erase(it);
+    }
+  });
+}
+
+void ProcessPathCache::Evict(pid_t pid, uint64_t start_id) {
+  entries_.Use([&](Entries &entries) {
+    auto it = entries.by_pid.find(pid);
+    if (it != entries.by_pid.end() && it->second.start_id == start_id) {
+      entries.Erase(it);
+    }
+  });
+}
+
+size_t ProcessPathCache::Size() const {
+  return entries_.Use([](auto &entries) { return entries.by_pid.size(); });
+}
+
+void ProcessPathCache::Entries::Erase(
+    std::unordered_map<pid_t, Entry>::iterator it) {
+  Cancel(it->second);
+  uses.erase(it->second.use);
+  by_pid.erase(it);
+}
+
+std::unique_ptr<dispatch::ProcessExitSource> ProcessPathCache::WatchExit(
+    pid_t pid, uint64_t start_id) {
+#if defined(__APPLE__)
+  auto source = std::make_unique<dispatch::ProcessExitSource>(pid, queue_);
+  source->SetEventHandler([this, pid, start_id]() { Evict(pid, start_id); });
+  source->Resume();
+  return source;
+#else
+  (void)pid;
+  (void)start_id;
+  return nullptr;
+#endif
+}
+
+void ProcessPathCache::Cancel(Entry &entry) {
+  if (entry.exit_source) {
+    entry.exit_source->Cancel();
+  }
+}
+
+}  // namespace mcom
@@ -0,0 +1,88 @@
+// Paragon Firewall Community Edition
+// Copyright (C) 2019-2020  Paragon Software GmbH
+//
+// This file is part of Paragon Firewall Community Edition.
+//
+// Paragon Firewall Community Edition is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// Paragon Firewall Community Edition is distributed in the hope that it
+// will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Paragon Firewall Community Edition. If not, see
+//   <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include <unistd.h>
+
+#include <mcom/dispatch.hpp>
+#include <mcom/file_path.hpp>
+#include <mcom/result.hpp>
+#include <mcom/sync.hpp>
+
+namespace mcom {
+
+// Caches ProcessPath() results. Entries are keyed by pid and a start id that
+// tells apart processes reusing the same pid, and are dropped when the process
+// exits (where DISPATCH_SOURCE_TYPE_PROC is available) or, least recently used
+// first, when the cache overflows.
+class ProcessPathCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 4096;
+
+  explicit ProcessPathCache(size_t capacity = kDefaultCapacity);
+
+  ~ProcessPathCache();
+
+  ProcessPathCache &operator=(ProcessPathCache &&) = delete;
+
+  // start_id is any value unique to this incarnation of the pid, e.g. the
+  // pidversion of an audit token. ProcessStartTime() is used when it is not
+  // given; it stays the same across exec, so a process that execs keeps its
+  // old path until it exits. Pass a start id when that matters.
+  Result<FilePath> Path(pid_t pid, std::optional<uint64_t> start_id = {});
+
+  void Evict(pid_t pid);
+
+  size_t Size() const;
+
+ private:
+  struct Entry {
+    uint64_t start_id;
+    FilePath path;
+    std::unique_ptr<dispatch::ProcessExitSource> exit_source;
+    std::list<pid_t>::iterator use;
+  };
+
+  struct Entries {
+    std::unordered_map<pid_t, Entry> by_pid;
+    // Most recently used first
+    std::list<pid_t> uses;
+
+    void Erase(std::unordered_map<pid_t, Entry>::iterator it);
+  };
+
+  void Evict(pid_t pid, uint64_t start_id);
+
+  std::unique_ptr<dispatch::ProcessExitSource> WatchExit(pid_t pid,
+                                                         uint64_t start_id);
+
+  static void Cancel(Entry &entry);
+
+  const size_t capacity_;
+  dispatch::Queue queue_;
+  Sync<Entries> entries_;
+};
+
+}  // namespace mcom
@@ -22,19 +22,68 @@
 #include <cerrno>
 #include <system_error>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace mcom {
 
-std::vector<std::string> StrSplit(const std::string &str, char delimiter) {
-  size_t pos = 0;
-  size_t dpos;
-  std::vector<std::string> comps;
+size_t FindChar(std::string_view str, char c, size_t pos) noexcept {
+  const char *data = str.data();
+  const size_t size = str.size();
+  if (pos >= size) {
+    return std::string_view::npos;
+  }
 
-  while ((dpos = str.find_first_of(delimiter, pos)) != str.npos) {
-    comps.push_back(str.substr(pos, dpos - pos));
-    pos = dpos + 1;
+#if defined(__SSE2__)
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; pos + 16 <= size; pos += 16) {
+    const __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask != 0) {
+      return pos + size_t(__builtin_ctz(unsigned(mask)));
+    }
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t needle = vdupq_n_u8(uint8_t(c));
+  for (; pos + 16 <= size; pos += 16) {
+    const uint8x16_t equal = vceqq_u8(
+        vld1q_u8(reinterpret_cast<const uint8_t *>(data + pos)), needle);
+    // NEON has no movemask; narrowing leaves 4 bits per byte in 64 bits
+    const uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+    if (mask != 0) {
+      return pos + size_t(__builtin_ctzll(mask) >> 2);
+    }
   }
+#endif
+
+  for (; pos < size; ++pos) {
+    if (data[pos] == c) {
+      return pos;
+    }
+  }
+
+  return std::string_view::npos;
+}
 
-  return comps;
+std::vector<std::string> StrSplit(const std::string &str, char delimiter) {
+  std::vector<std::string> tokens;
+
+  size_t pos = 0;
+  while (true) {
+    const size_t end = FindChar(str, delimiter, pos);
+    if (end == std::string_view::npos) {
+      tokens.emplace_back(str, pos);
+      return tokens;
+    }
+
+    tokens.emplace_back(str, pos, end - pos);
+    pos = end + 1;
+  }
 }
 
 std::string StrFormat(const char *format, ...) {
@@ -60,15 +109,4 @@ std::string StrFormat(const char *format, va_list vl) {
   return ss;
 }
 
-bool HasSuffix(const char *str, const char *suffix) {
-  const size_t str_len = std::strlen(str);
-  const size_t suffix_len = std::strlen(suffix);
-
-  if (str_len < suffix_len) {
-    return false;
-  }
-
-  return 0 == std::memcmp(str + str_len - suffix_len, suffix, suffix_len);
-}
-
 }  // namespace mcom
@@ -20,16 +20,43 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace mcom {
 
+// Position of the first `c` in `str` at or after `pos`, npos if there is
+// none. Compares 16 bytes at a time with SSE2 or NEON where available.
+size_t FindChar(std::string_view str, char c, size_t pos = 0) noexcept;
+
+// The parts of `str` between delimiters: "a,,b," gives "a", "", "b" and "".
 std::vector<std::string> StrSplit(const std::string &str, char delimiter);
 
 std::string StrFormat(const char *format, ...) __printflike(1, 2);
 
 std::string StrFormat(const char *format, va_list) __printflike(1, 0);
 
-bool HasSuffix(const char *str, const char *suffix);
+inline bool HasPrefix(std::string_view str, std::string_view prefix) noexcept {
+  return str.size() >= prefix.size() &&
+         str.compare(0, prefix.size(), prefix) == 0;
+}
+
+inline bool HasSuffix(std::string_view str, std::string_view suffix) noexcept {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// `str` without `prefix`, or `str` itself if it doesn't start with it
+inline std::string_view StripPrefix(std::string_view str,
+                                    std::string_view prefix) noexcept {
+  return HasPrefix(str, prefix) ? str.substr(prefix.size()) : str;
+}
+
+// `str` without `suffix`, or `str` itself if it doesn't end with it
+inline std::string_view StripSuffix(std::string_view str,
+                                    std::string_view suffix) noexcept {
+  return HasSuffix(str, suffix) ? str.substr(0, str.size() - suffix.size())
+                                : str;
+}
 
 }  // namespace mcom
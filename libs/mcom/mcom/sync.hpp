@@ -19,7 +19,13 @@
 
 #pragma once
 
+#include <array>
+#include <functional>
+#include <shared_mutex>
+#include <unordered_map>
+
 #include <mcom/dispatch.hpp>
+#include <mcom/lock_profiling.hpp>
 
 namespace mcom {
 
@@ -29,6 +35,10 @@ class Sync {
   template <class... Args>
   Sync(Args &&... args) : value_{std::forward<Args>(args)...} {}
 
+  template <class... Args>
+  Sync(LockName name, Args &&... args)
+      : sema_{1, name.value}, value_{std::forward<Args>(args)...} {}
+
   Sync &operator=(Sync &&) = delete;
 
   class Guard {
@@ -37,18 +47,15 @@ class Sync {
 
     T &operator*() { return sync_.value_; }
 
-    ~Guard() { sync_.sema_.Signal(); }
-
     Guard &operator=(Guard &&) = delete;
 
    private:
     friend class Sync;
 
-    Guard(Sync &sync) : sync_{sync} {
-      sync_.sema_.Wait(dispatch::Time::kForever);
-    }
+    Guard(Sync &sync) : sync_{sync}, lock_{sync.sema_} {}
 
     Sync &sync_;
+    dispatch::Semaphore::Guard lock_;
   };
 
   class ConstGuard {
@@ -57,18 +64,15 @@ class Sync {
 
     const T &operator*() { return sync_.value_; }
 
-    ~ConstGuard() { sync_.sema_.Signal(); }
-
     ConstGuard &operator=(Guard &&) = delete;
 
    private:
     friend class Sync;
 
-    ConstGuard(const Sync &sync) : sync_{sync} {
-      sync_.sema_.Wait(dispatch::Time::kForever);
-    }
+    ConstGuard(const Sync &sync) : sync_{sync}, lock_{sync.sema_} {}
 
     const Sync &sync_;
+    dispatch::Semaphore::Guard lock_;
   };
 
   Guard Locked() { return Guard{*this}; }
@@ -104,4 +108,98 @@ class Sync {
   T value_;
 };
 
+// Reader-writer variant of Sync. Use() takes the lock exclusively, while
+// readers going through UseShared() don't block each other.
+template <class T>
+class SharedSync {
+ public:
+  template <class... Args>
+  SharedSync(Args &&... args) : value_{std::forward<Args>(args)...} {}
+
+  template <class... Args>
+  SharedSync(LockName name, Args &&... args)
+      : site_{LockSite::Named(name.value)},
+        value_{std::forward<Args>(args)...} {}
+
+  SharedSync &operator=(SharedSync &&) = delete;
+
+  template <class Fn>
+  auto Use(Fn &&fn) -> decltype(fn(std::declval<T &>())) {
+    LockProbe probe{site_};
+    std::unique_lock<std::shared_mutex> lock{mutex_, std::defer_lock};
+    Acquire(lock, probe);
+    return fn(value_);
+  }
+
+  template <class Fn>
+  auto UseShared(Fn &&fn) const -> decltype(fn(std::declval<const T &>())) {
+    LockProbe probe{site_};
+    std::shared_lock<std::shared_mutex> lock{mutex_, std::defer_lock};
+    Acquire(lock, probe);
+    return fn(value_);
+  }
+
+  T &AccessUnsafely() { return value_; }
+
+  const T &AccessUnsafely() const { return value_; }
+
+ private:
+  template <class Lock>
+  static void Acquire(Lock &lock, LockProbe &probe) {
+    if (!probe.Enabled()) {
+      lock.lock();
+      return;
+    }
+
+    const bool contended = !lock.try_lock();
+    if (contended) {
+      lock.lock();
+    }
+    probe.Acquired(contended);
+  }
+
+  mutable std::shared_mutex mutex_;
+  LockSite *const site_ = nullptr;
+  T value_;
+};
+
+// Hash map split into ShardCount independently locked shards. Operations on
+// keys that land in different shards don't contend with each other.
+template <class Key, class Value, class Hash = std::hash<Key>,
+          size_t ShardCount = 16>
+class ShardedSync {
+ public:
+  using Map = std::unordered_map<Key, Value, Hash>;
+
+  static_assert(ShardCount > 0, "ShardedSync needs at least one shard");
+
+  ShardedSync &operator=(ShardedSync &&) = delete;
+
+  // Calls fn with the locked shard that owns the key.
+  template <class Fn>
+  auto Use(const Key &key, Fn &&fn) -> decltype(fn(std::declval<Map &>())) {
+    return shards_[ShardIndex(key)].Use(std::forward<Fn>(fn));
+  }
+
+  // Visits every shard in turn, holding only one shard lock at a time.
+  template <class Fn>
+  void ForEachShard(Fn &&fn) {
+    for (auto &shard : shards_) {
+      shard.Use([&](Map &map) { fn(map); });
+    }
+  }
+
+  template <class Fn>
+  void ForEachShard(Fn &&fn) const {
+    for (auto &shard : shards_) {
+      shard.Use([&](const Map &map) { fn(map); });
+    }
+  }
+
+ private:
+  static size_t ShardIndex(const Key &key) { return Hash{}(key) % ShardCount; }
+
+  std::array<Sync<Map>, ShardCount> shards_;
+};
+
 }  // namespace mcom
@@ -22,56 +22,100 @@
 
 #include "uuid.hpp"
 
-#include <libkern/OSByteOrder.h>
+#include <array>
 
 namespace {
 
 GUID SwapGUID(const GUID &in_guid) {
   GUID out_guid;
 
-  out_guid.Data1 = OSSwapInt32(in_guid.Data1);
-  out_guid.Data2 = OSSwapInt16(in_guid.Data2);
-  out_guid.Data3 = OSSwapInt16(in_guid.Data3);
+  out_guid.Data1 = __builtin_bswap32(in_guid.Data1);
+  out_guid.Data2 = __builtin_bswap16(in_guid.Data2);
+  out_guid.Data3 = __builtin_bswap16(in_guid.Data3);
   std::memcpy(&out_guid.Data4, &in_guid.Data4, sizeof(GUID::Data4));
 
   return out_guid;
 }
 
+constexpr uint8_t kInvalidDigit = 0xff;
+
+constexpr std::array<uint8_t, 256> MakeHexDigits() {
+  std::array<uint8_t, 256> digits{};
+  for (auto &digit : digits) {
+    digit = kInvalidDigit;
+  }
+  for (int i = 0; i < 10; ++i) {
+    digits['0' + i] = uint8_t(i);
+  }
+  for (int i = 0; i < 6; ++i) {
+    digits['a' + i] = uint8_t(10 + i);
+    digits['A' + i] = uint8_t(10 + i);
+  }
+  return digits;
+}
+
+constexpr std::array<uint8_t, 256> kHexDigits = MakeHexDigits();
+
+constexpr char kLowerHex[] = "0123456789abcdef";
+
+// Offsets of the two digits of each byte in the string form
+constexpr std::array<uint8_t, 16> kByteOffsets{
+    0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34};
+
 }  // namespace
 
 namespace mcom {
 
-Uuid::Uuid(const uuid_t &uuid) { uuid_copy(value_, uuid); }
+Uuid::Uuid(const uuid_t &uuid) { std::memcpy(value_, uuid, sizeof(uuid_t)); }
 
 Uuid::Uuid(const GUID &in_guid) {
   static_assert(sizeof(GUID) == sizeof(uuid_t), "");
 
-  auto &out_guid = *reinterpret_cast<GUID *>(&value_);
-  out_guid = SwapGUID(in_guid);
+  // uuid_t is a byte array and may not be aligned for GUID
+  const GUID out_guid = SwapGUID(in_guid);
+  std::memcpy(value_, &out_guid, sizeof(out_guid));
 }
 
 std::string Uuid::ToString() const {
-  uuid_string_t uuid_str;
-  uuid_unparse_lower(value_, uuid_str);
-  return uuid_str;
+  std::string str(kStringLength, '\0');
+  ToChars(str.data());
+  return str;
+}
+
+void Uuid::ToChars(char *buffer) const noexcept {
+  buffer[8] = buffer[13] = buffer[18] = buffer[23] = '-';
+
+  for (size_t index = 0; index < sizeof(uuid_t); ++index) {
+    const uint8_t byte = value_[index];
+    buffer[kByteOffsets[index]] = kLowerHex[byte >> 4];
+    buffer[kByteOffsets[index] + 1] = kLowerHex[byte & 0xf];
+  }
 }
 
 GUID Uuid::ToGUID() const {
-  auto &guid = *reinterpret_cast<const GUID *>(&value_);
+  GUID guid;
+  std::memcpy(&guid, value_, sizeof(guid));
   return SwapGUID(guid);
 }
 
 Optional<Uuid> Uuid::FromString(std::string_view uuid_str) {
-  if (uuid_str.size() != 36) {
+  if (uuid_str.size() != kStringLength || uuid_str[8] != '-' ||
+      uuid_str[13] != '-' || uuid_str[18] != '-' || uuid_str[23] != '-') {
     return nullopt;
   }
 
-  uuid_string_t uuid_str_buffer;
-  std::memcpy(uuid_str_buffer, uuid_str.data(), 36);
-  uuid_str_buffer[36] = '\0';
-
+  // Invalid digits are collected rather than checked one by one
+  uint8_t invalid = 0;
   uuid_t uuid;
-  if (0 != uuid_parse(uuid_str_buffer, uuid)) {
+
+  for (size_t index = 0; index < sizeof(uuid_t); ++index) {
+    const uint8_t high = kHexDigits[uint8_t(uuid_str[kByteOffsets[index]])];
+    const uint8_t low = kHexDigits[uint8_t(uuid_str[kByteOffsets[index] + 1])];
+    invalid |= (high | low) & 0xf0;
+    uuid[index] = uint8_t((high << 4) | (low & 0xf));
+  }
+
+  if (invalid != 0) {
     return nullopt;
   }
 
@@ -79,11 +123,3 @@ Optional<Uuid> Uuid::FromString(std::string_view uuid_str) {
 }
 
 }  // namespace mcom
-
-namespace std {
-
-size_t hash<mcom::Uuid>::operator()(const mcom::Uuid &uuid) const {
-  return hash<std::string>{}(uuid.ToString());
-}
-
-}  // namespace std
@@ -22,9 +22,17 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <string>
+#include <string_view>
 
+#if __has_include(<uuid/uuid.h>)
 #include <uuid/uuid.h>
+#else
+typedef unsigned char uuid_t[16];
+#endif
 
 #include <mcom/optional.hpp>
 
@@ -43,6 +51,9 @@ namespace mcom {
 
 class Uuid {
  public:
+  // "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+  static constexpr size_t kStringLength = 36;
+
   Uuid() : value_{} {}
 
   Uuid(const uuid_t &uuid);
@@ -53,8 +64,12 @@ class Uuid {
 
   std::string ToString() const;
 
+  // Writes kStringLength lowercase characters, without a terminating NUL
+  void ToChars(char *buffer) const noexcept;
+
   GUID ToGUID() const;
 
+  // Accepts either case
   static Optional<Uuid> FromString(std::string_view uuid_str);
 
  private:
@@ -62,11 +77,11 @@ class Uuid {
 };
 
 inline bool operator==(const Uuid &lhs, const Uuid &rhs) {
-  return 0 == uuid_compare(lhs.Value(), rhs.Value());
+  return 0 == std::memcmp(lhs.Value(), rhs.Value(), sizeof(uuid_t));
 }
 
 inline bool operator!=(const Uuid &lhs, const Uuid &rhs) {
-  return 0 != uuid_compare(lhs.Value(), rhs.Value());
+  return !(lhs == rhs);
 }
 
 }  // namespace mcom
@@ -75,7 +90,24 @@ namespace std {
 
 template <>
 struct hash<mcom::Uuid> {
-  std::size_t operator()(const mcom::Uuid &uuid) const;
+  std::size_t operator()(const mcom::Uuid &uuid) const noexcept {
+    uint64_t low;
+    uint64_t high;
+    std::memcpy(&low, uuid.Value(), sizeof(low));
+    std::memcpy(&high, uuid.Value() + sizeof(low), sizeof(high));
+
+    // Not every UUID is random; time-based and hand-made ones differ in a
+    // few bytes only, so all 128 bits are folded and mixed (MurmurHash3's
+    // finalizer)
+    uint64_t hash = low * 0x9e3779b97f4a7c15 + high;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+
+    return std::size_t(hash);
+  }
 };
 
 }  // namespace std
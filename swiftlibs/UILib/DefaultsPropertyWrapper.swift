@@ -26,6 +26,7 @@ public protocol PropertyListType {}
 
 extension Bool: PropertyListType {}
 extension UInt32: PropertyListType {}
+extension UInt64: PropertyListType {}
 extension Int: PropertyListType {}
 
 @propertyWrapper